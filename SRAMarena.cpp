@@ -0,0 +1,45 @@
+/*  SRAMarena.cpp - Arena (region) allocation in external SRAM.
+ */
+
+#include "SRAMarena.h"
+
+SRAMarena::SRAMarena() : _sram(NULL), _base(0), _size(0), _top(0), _peak(0)
+{
+}
+
+SRAMarena::~SRAMarena(){
+  End();
+}
+
+bool SRAMarena::Begin(SRAMsimple& sram, size_t size){
+  End();
+  uint32_t base = sram.SRAMMalloc(size);
+  if (base == SRAM_ALLOC_FAIL) return false;
+  _sram = &sram;
+  _base = base;
+  _size = size;
+  _top = 0;
+  _peak = 0;
+  return true;
+}
+
+void SRAMarena::End(){
+  if (_sram) _sram->SRAMFree(_base);
+  _sram = NULL;
+  _size = 0;
+  _top = 0;
+}
+
+// align must be a power of two; offsets are aligned relative to the region,
+// whose base is SRAM_HEAP_ALIGN aligned
+uint32_t SRAMarena::Alloc(size_t size, uint32_t align){
+  uint32_t offset = (_top + align - 1) & ~(align - 1);
+  if (offset > _size || size > _size - offset) return SRAM_ALLOC_FAIL;
+  _top = offset + size;
+  if (_top > _peak) _peak = _top;
+  return _base + offset;
+}
+
+void SRAMarena::Rewind(uint32_t mark){
+  if (mark < _top) _top = mark;
+}
@@ -0,0 +1,50 @@
+/*  SRAMarena.h - Arena (region) allocation in external SRAM.
+ *  An arena takes one block from the SRAMsimple heap and hands out pieces of
+ *  it by bumping an offset, with no per-object bookkeeping. Everything is
+ *  released together with Reset() or End(), or back to a Mark() with Rewind()
+ *  for nested scopes.
+ */
+
+#ifndef SRAMarena_h
+#define SRAMarena_h
+
+#include "SRAMsimple.h"
+
+class SRAMarena {
+  private:
+  SRAMsimple *_sram;
+  uint32_t _base;
+  uint32_t _size;
+  uint32_t _top;                      // offset of the first free byte
+  uint32_t _peak;
+
+  public:
+    SRAMarena();
+    ~SRAMarena();
+    SRAMarena(const SRAMarena&) = delete;               // a copy would free the region twice
+    SRAMarena& operator=(const SRAMarena&) = delete;
+    bool Begin(SRAMsimple& sram, size_t size);          // false when the heap cannot supply the region
+    void End();                                         // returns the region to the heap
+    uint32_t Alloc(size_t size, uint32_t align = 4);    // SRAM_ALLOC_FAIL when the arena is full
+    uint32_t Mark() { return _top; }
+    void Rewind(uint32_t mark);                         // frees everything allocated after Mark()
+    void Reset() { _top = 0; }
+    uint32_t Used() { return _top; }
+    uint32_t Remaining() { return _size - _top; }
+    uint32_t Peak() { return _peak; }
+};
+
+// Rewinds an arena to where it was when the scope was entered
+class SRAMarenaScope {
+  private:
+  SRAMarena& _arena;
+  uint32_t _mark;
+
+  public:
+    SRAMarenaScope(SRAMarena& arena) : _arena(arena), _mark(arena.Mark()) {}
+    ~SRAMarenaScope() { _arena.Rewind(_mark); }
+    SRAMarenaScope(const SRAMarenaScope&) = delete;
+    SRAMarenaScope& operator=(const SRAMarenaScope&) = delete;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*  SRAMarray.h - Typed access to external SRAM: SramPtr<T>, SramRef<T> and
+ *  SramArray<T>. Any trivially copyable T is moved as raw bytes in one
+ *  sequential burst straight from or into the caller's memory, replacing the
+ *  old per-type WriteIntArray/ReadFloatArray style functions.
+ *
+ *  SRAM_BYTE_ORDER selects at compile time how multi-byte arithmetic values
+ *  are laid out in the chip. The native little-endian layout needs no
+ *  conversion; SRAM_BIG_ENDIAN (the layout the old Int/Long functions used)
+ *  swaps in place after a read and through a 64-byte stack buffer on writes.
+ */
+
+#ifndef SRAMarray_h
+#define SRAMarray_h
+
+#include <type_traits>
+#include "SRAMsimple.h"
+
+#define SRAM_LITTLE_ENDIAN  0
+#define SRAM_BIG_ENDIAN     1
+
+#ifndef SRAM_BYTE_ORDER
+#define SRAM_BYTE_ORDER SRAM_LITTLE_ENDIAN
+#endif
+
+namespace sram_detail {
+
+template <typename T, int Order>
+struct NeedsSwap {
+  static const bool value = Order == SRAM_BIG_ENDIAN && std::is_arithmetic<T>::value && sizeof(T) > 1;
+};
+
+template <typename T>
+inline void SwapInPlace(T *values, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    uint8_t *b = (uint8_t *)&values[i];
+    for (size_t lo = 0, hi = sizeof(T) - 1; lo < hi; lo++, hi--) {
+      uint8_t t = b[lo];
+      b[lo] = b[hi];
+      b[hi] = t;
+    }
+  }
+}
+
+// Native layout: the caller's buffer goes on the wire as is
+template <typename T, bool Swap>
+struct Codec {
+  static void Write(SRAMsimple& sram, uint32_t address, const T *src, size_t count) {
+    sram.SpiWriteByteArray(address, (const uint8_t *)src, count * sizeof(T));
+  }
+  static void Read(SRAMsimple& sram, uint32_t address, T *dst, size_t count) {
+    sram.SpiReadByteArray(address, count * sizeof(T), (uint8_t *)dst);
+  }
+};
+
+// Swapped layout, still one transaction per call
+template <typename T>
+struct Codec<T, true> {
+  static void Write(SRAMsimple& sram, uint32_t address, const T *src, size_t count) {
+    T chunk[64 / sizeof(T)];
+    const size_t per = sizeof(chunk) / sizeof(T);
+    sram.BeginWrite(address);
+    while (count > 0) {
+      size_t n = count < per ? count : per;
+      memcpy(chunk, src, n * sizeof(T));
+      SwapInPlace(chunk, n);
+      sram.WriteBytes((const uint8_t *)chunk, n * sizeof(T));
+      src += n;
+      count -= n;
+    }
+    sram.EndTransaction();
+  }
+  static void Read(SRAMsimple& sram, uint32_t address, T *dst, size_t count) {
+    sram.SpiReadByteArray(address, count * sizeof(T), (uint8_t *)dst);
+    SwapInPlace(dst, count);
+  }
+};
+
+}
+
+// Reference to one T in external SRAM: reading converts to T, assigning writes
+template <typename T, int Order = SRAM_BYTE_ORDER>
+class SramRef {
+  static_assert(std::is_trivially_copyable<T>::value, "external SRAM holds trivially copyable types only");
+  typedef sram_detail::Codec<T, sram_detail::NeedsSwap<T, Order>::value> Codec;
+
+  SRAMsimple *_sram;
+  uint32_t _address;
+
+  public:
+    SramRef(SRAMsimple& sram, uint32_t address) : _sram(&sram), _address(address) {}
+    uint32_t address() const { return _address; }
+    T Get() const { T value; Codec::Read(*_sram, _address, &value, 1); return value; }
+    void Set(const T& value) { Codec::Write(*_sram, _address, &value, 1); }
+    operator T() const { return Get(); }
+    SramRef& operator=(const T& value) { Set(value); return *this; }
+    SramRef& operator=(const SramRef& other) { Set(other.Get()); return *this; }
+};
+
+// Pointer into external SRAM with the usual arithmetic; also the iterator of SramArray
+template <typename T, int Order = SRAM_BYTE_ORDER>
+class SramPtr {
+  SRAMsimple *_sram;
+  uint32_t _address;
+
+  public:
+    SramPtr(SRAMsimple& sram, uint32_t address) : _sram(&sram), _address(address) {}
+    uint32_t address() const { return _address; }
+    SramRef<T, Order> operator*() const { return SramRef<T, Order>(*_sram, _address); }
+    SramRef<T, Order> operator[](ptrdiff_t i) const { return SramRef<T, Order>(*_sram, _address + i * sizeof(T)); }
+    SramPtr operator+(ptrdiff_t n) const { return SramPtr(*_sram, _address + n * sizeof(T)); }
+    SramPtr operator-(ptrdiff_t n) const { return SramPtr(*_sram, _address - n * sizeof(T)); }
+    ptrdiff_t operator-(const SramPtr& other) const { return ((ptrdiff_t)_address - (ptrdiff_t)other._address) / (ptrdiff_t)sizeof(T); }
+    SramPtr& operator+=(ptrdiff_t n) { _address += n * sizeof(T); return *this; }
+    SramPtr& operator-=(ptrdiff_t n) { _address -= n * sizeof(T); return *this; }
+    SramPtr& operator++() { _address += sizeof(T); return *this; }
+    SramPtr& operator--() { _address -= sizeof(T); return *this; }
+    SramPtr operator++(int) { SramPtr old = *this; _address += sizeof(T); return old; }
+    SramPtr operator--(int) { SramPtr old = *this; _address -= sizeof(T); return old; }
+    bool operator==(const SramPtr& other) const { return _address == other._address; }
+    bool operator!=(const SramPtr& other) const { return _address != other._address; }
+};
+
+// Fixed-size array of T in external SRAM. Element access through operator[]
+// or iteration costs one transaction per element; Read/Write move any run of
+// elements in one burst.
+template <typename T, int Order = SRAM_BYTE_ORDER>
+class SramArray {
+  static_assert(std::is_trivially_copyable<T>::value, "external SRAM holds trivially copyable types only");
+  typedef sram_detail::Codec<T, sram_detail::NeedsSwap<T, Order>::value> Codec;
+
+  SRAMsimple *_sram;
+  uint32_t _address;
+  size_t _count;
+
+  public:
+    SramArray(SRAMsimple& sram, uint32_t address, size_t count) : _sram(&sram), _address(address), _count(count) {}
+    uint32_t address() const { return _address; }
+    size_t size() const { return _count; }
+    SramRef<T, Order> operator[](size_t i) const { return SramRef<T, Order>(*_sram, _address + i * sizeof(T)); }
+    SramPtr<T, Order> begin() const { return SramPtr<T, Order>(*_sram, _address); }
+    SramPtr<T, Order> end() const { return SramPtr<T, Order>(*_sram, _address + _count * sizeof(T)); }
+    void Write(const T *src, size_t count, size_t first = 0) { Codec::Write(*_sram, _address + first * sizeof(T), src, count); }
+    void Read(T *dst, size_t count, size_t first = 0) const { Codec::Read(*_sram, _address + first * sizeof(T), dst, count); }
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*  SRAMcache.cpp - Write-back cache in MCU RAM in front of a SRAMsimple chip.
+ */
+
+#include "SRAMcache.h"
+
+SRAMcache::SRAMcache(SRAMsimple& sram) : _sram(sram), _tick(0)
+{
+  Invalidate();
+  ResetStats();
+}
+
+void SRAMcache::ResetStats(){
+  memset(&stats, 0, sizeof(stats));
+}
+
+void SRAMcache::Invalidate(){
+  for (uint32_t set = 0; set < SRAM_CACHE_SETS; set++) {
+    for (uint32_t way = 0; way < SRAM_CACHE_WAYS; way++) {
+      _lines[set][way].valid = false;
+      _lines[set][way].dirty = false;
+    }
+  }
+}
+
+void SRAMcache::WriteBack(Line &line, uint32_t set){
+  uint32_t address = (line.tag * SRAM_CACHE_SETS + set) * SRAM_CACHE_LINE;
+  _sram.SpiWriteByteArray(address, line.data, SRAM_CACHE_LINE);
+  line.dirty = false;
+  stats.writebacks++;
+}
+
+// Finds the line holding line_no, replacing the least recently used way of
+// its set on a miss. The new line is read from the chip only when fill is set,
+// i.e. when the caller will not overwrite all of it.
+SRAMcache::Line *SRAMcache::Lookup(uint32_t line_no, bool fill){
+  uint32_t set = line_no % SRAM_CACHE_SETS;
+  uint32_t tag = line_no / SRAM_CACHE_SETS;
+  Line *ways = _lines[set];
+  Line *victim = &ways[0];
+  _tick++;
+  for (uint32_t way = 0; way < SRAM_CACHE_WAYS; way++) {
+    if (ways[way].valid && ways[way].tag == tag) {
+      ways[way].last_use = _tick;
+      stats.hits++;
+      return &ways[way];
+    }
+    if (!ways[way].valid) victim = &ways[way];
+    else if (victim->valid && ways[way].last_use < victim->last_use) victim = &ways[way];
+  }
+
+  stats.misses++;
+  if (victim->valid) {
+    stats.evictions++;
+    if (victim->dirty) WriteBack(*victim, set);
+  }
+  if (fill) _sram.SpiReadByteArray(line_no * SRAM_CACHE_LINE, SRAM_CACHE_LINE, victim->data);
+  victim->tag = tag;
+  victim->valid = true;
+  victim->dirty = false;
+  victim->last_use = _tick;
+  return victim;
+}
+
+void SRAMcache::Read(uint32_t address, uint8_t *data, size_t size){
+  while (size > 0) {
+    uint32_t offset = address % SRAM_CACHE_LINE;
+    size_t n = SRAM_CACHE_LINE - offset < size ? SRAM_CACHE_LINE - offset : size;
+    Line *line = Lookup(address / SRAM_CACHE_LINE, true);
+    memcpy(data, line->data + offset, n);
+    address += n;
+    data += n;
+    size -= n;
+  }
+}
+
+void SRAMcache::Write(uint32_t address, const uint8_t *data, size_t size){
+  while (size > 0) {
+    uint32_t offset = address % SRAM_CACHE_LINE;
+    size_t n = SRAM_CACHE_LINE - offset < size ? SRAM_CACHE_LINE - offset : size;
+    Line *line = Lookup(address / SRAM_CACHE_LINE, n < SRAM_CACHE_LINE);
+    memcpy(line->data + offset, data, n);
+    line->dirty = true;
+    address += n;
+    data += n;
+    size -= n;
+  }
+}
+
+// Words are stored MSB first, the same layout as SRAMsimple::WriteWord
+uint32_t SRAMcache::ReadWord(uint32_t address){
+  uint8_t b[4];
+  Read(address, b, 4);
+  return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+void SRAMcache::WriteWord(uint32_t address, uint32_t data){
+  uint8_t b[4] = { (uint8_t)(data >> 24), (uint8_t)(data >> 16), (uint8_t)(data >> 8), (uint8_t)data };
+  Write(address, b, 4);
+}
+
+void SRAMcache::Flush(){
+  for (uint32_t set = 0; set < SRAM_CACHE_SETS; set++) {
+    for (uint32_t way = 0; way < SRAM_CACHE_WAYS; way++) {
+      if (_lines[set][way].valid && _lines[set][way].dirty) WriteBack(_lines[set][way], set);
+    }
+  }
+}
@@ -0,0 +1,58 @@
+/*  SRAMcache.h - Write-back cache in MCU RAM in front of a SRAMsimple chip.
+ *  Set-associative with LRU replacement. Lines are whole 23AA04M pages, so a
+ *  fill or a write-back is one page-sized burst instead of a transaction per
+ *  access. Writes stay in the cache until the line is evicted or Flush() runs.
+ */
+
+#ifndef SRAMcache_h
+#define SRAMcache_h
+
+#include "SRAMsimple.h"
+
+#ifndef SRAM_CACHE_LINE
+#define SRAM_CACHE_LINE 32      // bytes per line, a power of two; 32 = one 23AA04M page
+#endif
+#ifndef SRAM_CACHE_SETS
+#define SRAM_CACHE_SETS 16      // a power of two
+#endif
+#ifndef SRAM_CACHE_WAYS
+#define SRAM_CACHE_WAYS 4
+#endif
+
+struct SRAMCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;                 // valid lines replaced
+  uint32_t writebacks;                // dirty lines written to the chip
+};
+
+class SRAMcache {
+  private:
+  struct Line {
+    uint32_t tag;
+    uint32_t last_use;                // LRU stamp
+    bool valid;
+    bool dirty;
+    uint8_t data[SRAM_CACHE_LINE];
+  };
+
+  SRAMsimple& _sram;
+  Line _lines[SRAM_CACHE_SETS][SRAM_CACHE_WAYS];
+  uint32_t _tick;
+
+  Line *Lookup(uint32_t line_no, bool fill);
+  void WriteBack(Line &line, uint32_t set);
+
+  public:
+    SRAMCacheStats stats;
+    SRAMcache(SRAMsimple& sram);
+    void Read(uint32_t address, uint8_t *data, size_t size);
+    void Write(uint32_t address, const uint8_t *data, size_t size);
+    uint32_t ReadWord(uint32_t address);
+    void WriteWord(uint32_t address, uint32_t data);
+    void Flush();                     // write back every dirty line
+    void Invalidate();                // drop every line without writing it back
+    void ResetStats();
+};
+
+#endif
@@ -0,0 +1,172 @@
+/*  SRAMdirectory.cpp - Named regions in external SRAM.
+ */
+
+#include "SRAMdirectory.h"
+
+SRAMdirectory::SRAMdirectory(SRAMsimple& sram) : _sram(sram), _mirror(SRAM_ALLOC_FAIL)
+{
+  Clear();
+}
+
+// The mirror is emptied too, so Restore cannot bring the entries back
+void SRAMdirectory::Clear(){
+  memset(_entries, 0, sizeof(_entries));
+  memset(_index, kNone, sizeof(_index));
+  _count = 0;
+  if (_mirror == SRAM_ALLOC_FAIL) return;
+  for (uint8_t e = 0; e < SRAM_DIR_ENTRIES; e++) Store(e);
+}
+
+// FNV-1a
+uint32_t SRAMdirectory::Hash(const char *name){
+  uint32_t h = 2166136261u;
+  while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+  return h;
+}
+
+// Linear probing, as in SRAMheap
+uint32_t SRAMdirectory::Lookup(const char *name){
+  uint32_t i = Hash(name) & (kIndexSize - 1);
+  while (_index[i] != kNone && strcmp(_entries[_index[i]].name, name) != 0) i = (i + 1) & (kIndexSize - 1);
+  return i;
+}
+
+// Backward-shift deletion, so lookups never need tombstones
+void SRAMdirectory::IndexRemove(uint32_t i){
+  for (uint32_t j = (i + 1) & (kIndexSize - 1); _index[j] != kNone; j = (j + 1) & (kIndexSize - 1)) {
+    uint32_t home = Hash(_entries[_index[j]].name) & (kIndexSize - 1);
+    if (((j - home) & (kIndexSize - 1)) >= ((j - i) & (kIndexSize - 1))) {
+      _index[i] = _index[j];
+      i = j;
+    }
+  }
+  _index[i] = kNone;
+}
+
+const SRAMDirEntry *SRAMdirectory::Find(const char *name){
+  uint8_t e = _index[Lookup(name)];
+  return e == kNone ? NULL : &_entries[e];
+}
+
+const SRAMDirEntry *SRAMdirectory::Entry(uint8_t slot){
+  if (slot >= SRAM_DIR_ENTRIES || _entries[slot].name[0] == 0) return NULL;
+  return &_entries[slot];
+}
+
+// A replaced entry's old region is freed
+bool SRAMdirectory::Add(const char *name, const SRAMRegion &region, uint32_t flags){
+  size_t length = strlen(name);
+  if (length == 0 || length >= SRAM_DIR_NAME) return false;
+  uint32_t i = Lookup(name);
+  uint8_t e = _index[i];
+  if (e == kNone) {
+    for (e = 0; e < SRAM_DIR_ENTRIES && _entries[e].name[0]; e++);
+    if (e == SRAM_DIR_ENTRIES) return false;
+    memcpy(_entries[e].name, name, length + 1);
+    _index[i] = e;
+    _count++;
+  } else if (_entries[e].region.address != region.address) {
+    _sram.SRAMFree(_entries[e].region.address);     // replaced
+  }
+  _entries[e].region = region;
+  _entries[e].flags = flags;
+  Store(e);
+  return true;
+}
+
+bool SRAMdirectory::Remove(const char *name){
+  uint32_t i = Lookup(name);
+  uint8_t e = _index[i];
+  if (e == kNone) return false;
+  IndexRemove(i);
+  _sram.SRAMFree(_entries[e].region.address);
+  memset(&_entries[e], 0, sizeof(_entries[e]));
+  _count--;
+  Store(e);
+  return true;
+}
+
+bool SRAMdirectory::Load(const char *name, const char *path, uint32_t flags){
+  return LoadBatch(&name, &path, 1, flags) == 1;
+}
+
+// All files go through one WriteFilesInChunks call. Names that cannot be
+// added have their regions freed again.
+size_t SRAMdirectory::LoadBatch(const char *const *names, const char *const *paths, size_t count, uint32_t flags){
+  SRAMRegion regions[SRAM_DIR_ENTRIES];
+  size_t added = 0;
+  while (count) {
+    size_t n = count < SRAM_DIR_ENTRIES ? count : SRAM_DIR_ENTRIES;
+    _sram.WriteFilesInChunks(paths, regions, n);
+    for (size_t f = 0; f < n; f++) {
+      if (regions[f].address == SRAM_ALLOC_FAIL) continue;
+      if (Add(names[f], regions[f], flags)) added++;
+      else _sram.SRAMFree(regions[f].address);
+    }
+    names += n;
+    paths += n;
+    count -= n;
+  }
+  return added;
+}
+
+/************ SRAM mirror ***************************/
+// Rounded up to SRAM_HEAP_ALIGN, so Size() - MirrorSize() can be claimed
+uint32_t SRAMdirectory::MirrorSize(){
+  uint32_t size = sizeof(Header) + SRAM_DIR_ENTRIES * sizeof(Slot);
+  return (size + SRAM_HEAP_ALIGN - 1) & ~(uint32_t)(SRAM_HEAP_ALIGN - 1);
+}
+
+// Writes entry e with its CRC into its slot of the mirror
+void SRAMdirectory::Store(uint8_t e){
+  if (_mirror == SRAM_ALLOC_FAIL) return;
+  Slot slot;
+  slot.entry = _entries[e];
+  slot.crc = SRAMsimple::Crc32(0, (const uint8_t *)&slot.entry, sizeof(slot.entry));
+  _sram.SpiWriteByteArray(_mirror + sizeof(Header) + e * sizeof(Slot), (const uint8_t *)&slot, sizeof(slot));
+}
+
+bool SRAMdirectory::Mirror(uint32_t address){
+  if (_sram.SRAMClaim(address, MirrorSize()) == SRAM_ALLOC_FAIL) return false;
+  if (_mirror != SRAM_ALLOC_FAIL) _sram.SRAMFree(_mirror);
+  _mirror = address;
+  Header header = {SRAM_DIR_MAGIC, SRAM_DIR_ENTRIES};
+  for (uint8_t e = 0; e < SRAM_DIR_ENTRIES; e++) Store(e);
+  _sram.SpiWriteByteArray(_mirror, (const uint8_t *)&header, sizeof(header));
+  return true;
+}
+
+// Entries whose slot fails its CRC (torn by a reset) or whose region cannot
+// be claimed (it overlaps something allocated since the reset) are dropped
+bool SRAMdirectory::Restore(uint32_t address){
+  Header header;
+  _sram.SpiReadByteArray(address, sizeof(header), (uint8_t *)&header);
+  if (header.magic != SRAM_DIR_MAGIC || header.entries != SRAM_DIR_ENTRIES ||
+      _sram.SRAMClaim(address, MirrorSize()) == SRAM_ALLOC_FAIL) return false;
+  if (_mirror != SRAM_ALLOC_FAIL) _sram.SRAMFree(_mirror);
+  _mirror = address;
+  memset(_index, kNone, sizeof(_index));
+  _count = 0;
+  for (uint8_t e = 0; e < SRAM_DIR_ENTRIES; e++) {
+    SRAMDirEntry &entry = _entries[e];
+    Slot slot;
+    _sram.SpiReadByteArray(address + sizeof(Header) + e * sizeof(Slot), sizeof(slot), (uint8_t *)&slot);
+    if (SRAMsimple::Crc32(0, (const uint8_t *)&slot.entry, sizeof(slot.entry)) != slot.crc) {
+      memset(&entry, 0, sizeof(entry));
+      Store(e);
+      continue;
+    }
+    entry = slot.entry;
+    if (entry.name[0] == 0) continue;
+    entry.name[SRAM_DIR_NAME - 1] = 0;
+    uint32_t i = Lookup(entry.name);
+    if (_index[i] != kNone || _sram.SRAMClaim(entry.region.address, entry.region.size) == SRAM_ALLOC_FAIL) {
+      memset(&entry, 0, sizeof(entry));
+      Store(e);
+      continue;
+    }
+    _index[i] = e;
+    _count++;
+  }
+  return true;
+}
@@ -0,0 +1,81 @@
+/*  SRAMdirectory.h - Named regions in external SRAM.
+ *  A fixed table of name -> region entries in MCU RAM with a hash index, so
+ *  looking a name up costs one hash and usually one string compare. The table
+ *  can be mirrored to a block of SRAM and read back with Restore() after a
+ *  reset, as long as the SRAM kept its contents.
+ */
+
+#ifndef SRAMdirectory_h
+#define SRAMdirectory_h
+
+#include "SRAMsimple.h"
+
+#ifndef SRAM_DIR_ENTRIES
+#define SRAM_DIR_ENTRIES 32    // named regions, a power of two up to 128
+#endif
+#ifndef SRAM_DIR_NAME
+#define SRAM_DIR_NAME 20       // bytes per name, terminator included
+#endif
+#define SRAM_DIR_MAGIC 0x53524432   // "SRD2", first word of the SRAM mirror
+
+struct SRAMDirEntry {
+  char name[SRAM_DIR_NAME];           // empty for a free slot
+  SRAMRegion region;
+  uint32_t flags;                     // free for the application
+};
+
+class SRAMdirectory {
+  private:
+  static const uint8_t kNone = 0xFF;
+  static const uint32_t kIndexSize = SRAM_DIR_ENTRIES * 2;   // probed with & (kIndexSize - 1)
+  static_assert((SRAM_DIR_ENTRIES & (SRAM_DIR_ENTRIES - 1)) == 0 && SRAM_DIR_ENTRIES <= 255,
+                "SRAM_DIR_ENTRIES must be a power of two and fit the 8-bit entry index");
+
+  struct Header {
+    uint32_t magic;
+    uint32_t entries;                 // SRAM_DIR_ENTRIES of the writer
+  };
+
+  // One entry of the mirror. Each carries its own CRC, so a reset in the
+  // middle of a Store costs the entry being written and no other.
+  struct Slot {
+    SRAMDirEntry entry;
+    uint32_t crc;
+  };
+
+  SRAMsimple& _sram;
+  SRAMDirEntry _entries[SRAM_DIR_ENTRIES];
+  uint8_t _index[kIndexSize];         // hash of the name -> entry
+  uint8_t _count;
+  uint32_t _mirror;                   // SRAM address of the mirror, SRAM_ALLOC_FAIL without one
+
+  static uint32_t Hash(const char *name);
+  uint32_t Lookup(const char *name);  // index position holding name, or of the empty slot ending its probe
+  void IndexRemove(uint32_t i);
+  void Store(uint8_t e);
+
+  public:
+    SRAMdirectory(SRAMsimple& sram);
+    // Adds or replaces an entry; false when the name is too long or the table is full
+    bool Add(const char *name, const SRAMRegion &region, uint32_t flags = 0);
+    const SRAMDirEntry *Find(const char *name);         // NULL when there is no such name
+    bool Remove(const char *name);                      // also frees the region
+    void Clear();                                       // forgets every entry, mirror included; frees nothing
+    // WriteFileInChunks and Add in one; the batch form keeps the loader's
+    // pipeline running from one file into the next. Returns the files added.
+    bool Load(const char *name, const char *path, uint32_t flags = 0);
+    size_t LoadBatch(const char *const *names, const char *const *paths, size_t count, uint32_t flags = 0);
+    uint8_t Count() { return _count; }
+    const SRAMDirEntry *Entry(uint8_t slot);            // slots 0 .. SRAM_DIR_ENTRIES-1, NULL when free
+    // Keeps a copy of the table at address, claimed from the heap, and
+    // rewrites the changed entry on every Add/Remove. A reset during that
+    // write loses the entry: Restore drops it and keeps the rest. The address
+    // must be a multiple of SRAM_HEAP_ALIGN, as for SRAMClaim; false otherwise.
+    static uint32_t MirrorSize();                       // a multiple of SRAM_HEAP_ALIGN
+    bool Mirror(uint32_t address);
+    // Reads the table back from a mirror at address (aligned as for Mirror)
+    // and claims its regions from the heap; false when there is no valid table there
+    bool Restore(uint32_t address);
+};
+
+#endif
@@ -0,0 +1,318 @@
+/*  SRAMheap.cpp - Two-level segregated fit (TLSF) allocator for external SRAM.
+ */
+
+#include "SRAMheap.h"
+#include <string.h>
+
+static int Log2(uint32_t x) {
+  return 31 - __builtin_clz(x);
+}
+
+SRAMheap::SRAMheap() {
+  Begin(0, 0);
+}
+
+void SRAMheap::Begin(uint32_t base, uint32_t size) {
+  _base = base;
+  _size = size & ~(uint32_t)(SRAM_HEAP_ALIGN - 1);
+  _fl_bitmap = 0;
+  memset(_sl_bitmap, 0, sizeof(_sl_bitmap));
+  memset(_heads, 0xFF, sizeof(_heads));
+  memset(_used, 0xFF, sizeof(_used));
+  memset(&_stats, 0, sizeof(_stats));
+  _spare = kNone;
+  for (int i = SRAM_HEAP_BLOCKS - 1; i >= 0; i--) ReleaseBlock(i);
+  if (_size == 0) return;
+
+  uint16_t b = NewBlock();
+  _first = b;                         // merges always keep the lower block, so this stays first
+  _blocks[b].address = _base;
+  _blocks[b].size = _size;
+  _blocks[b].prev_phys = kNone;
+  _blocks[b].next_phys = kNone;
+  InsertFree(b);
+}
+
+// Size class of a block of this many allocation units: the first level is the
+// power of two, the second splits it into kSlCount linear steps. Units below
+// kSlCount each get their own list.
+void SRAMheap::Mapping(uint32_t units, int &fl, int &sl) {
+  if (units < (uint32_t)kSlCount) {
+    fl = 0;
+    sl = units;
+  } else {
+    int log = Log2(units);
+    fl = log - kSlLog + 1;
+    sl = (units >> (log - kSlLog)) - kSlCount;
+  }
+}
+
+uint16_t SRAMheap::NewBlock() {
+  uint16_t b = _spare;
+  if (b != kNone) _spare = _blocks[b].next_free;
+  return b;
+}
+
+void SRAMheap::ReleaseBlock(uint16_t b) {
+  _blocks[b].next_free = _spare;
+  _spare = b;
+}
+
+void SRAMheap::InsertFree(uint16_t b) {
+  int fl, sl;
+  Mapping(_blocks[b].size / SRAM_HEAP_ALIGN, fl, sl);
+  uint16_t head = _heads[fl][sl];
+  _blocks[b].free = true;
+  _blocks[b].prev_free = kNone;
+  _blocks[b].next_free = head;
+  if (head != kNone) _blocks[head].prev_free = b;
+  _heads[fl][sl] = b;
+  _fl_bitmap |= 1u << fl;
+  _sl_bitmap[fl] |= 1u << sl;
+}
+
+void SRAMheap::RemoveFree(uint16_t b) {
+  int fl, sl;
+  Mapping(_blocks[b].size / SRAM_HEAP_ALIGN, fl, sl);
+  uint16_t prev = _blocks[b].prev_free;
+  uint16_t next = _blocks[b].next_free;
+  if (prev != kNone) _blocks[prev].next_free = next;
+  else _heads[fl][sl] = next;
+  if (next != kNone) _blocks[next].prev_free = prev;
+  if (_heads[fl][sl] == kNone) {
+    _sl_bitmap[fl] &= ~(1u << sl);
+    if (_sl_bitmap[fl] == 0) _fl_bitmap &= ~(1u << fl);
+  }
+  _blocks[b].free = false;
+}
+
+// Rounds the request up to the next class boundary, so any block in the
+// class found is large enough, then takes the first non-empty class from there
+uint16_t SRAMheap::FindFree(uint32_t units) {
+  if (units >= (uint32_t)kSlCount) units += (1u << (Log2(units) - kSlLog)) - 1;
+  int fl, sl;
+  Mapping(units, fl, sl);
+  if (fl >= kFlCount) return kNone;
+  uint32_t sl_map = _sl_bitmap[fl] & (~0u << sl);
+  if (sl_map == 0) {
+    uint32_t fl_map = fl + 1 < 32 ? _fl_bitmap & (~0u << (fl + 1)) : 0;
+    if (fl_map == 0) return kNone;
+    fl = __builtin_ctz(fl_map);
+    sl_map = _sl_bitmap[fl];
+  }
+  return _heads[fl][__builtin_ctz(sl_map)];
+}
+
+void SRAMheap::HashInsert(uint16_t b) {
+  uint32_t i = (_blocks[b].address / SRAM_HEAP_ALIGN) & (kHashSize - 1);
+  while (_used[i] != kNone) i = (i + 1) & (kHashSize - 1);
+  _used[i] = b;
+}
+
+// Linear probing with backward-shift deletion, so lookups never need tombstones
+uint16_t SRAMheap::HashRemove(uint32_t address) {
+  uint32_t i = (address / SRAM_HEAP_ALIGN) & (kHashSize - 1);
+  while (_used[i] != kNone && _blocks[_used[i]].address != address) i = (i + 1) & (kHashSize - 1);
+  uint16_t b = _used[i];
+  if (b == kNone) return kNone;
+  for (uint32_t j = (i + 1) & (kHashSize - 1); _used[j] != kNone; j = (j + 1) & (kHashSize - 1)) {
+    uint32_t home = (_blocks[_used[j]].address / SRAM_HEAP_ALIGN) & (kHashSize - 1);
+    if (((j - home) & (kHashSize - 1)) >= ((j - i) & (kHashSize - 1))) {
+      _used[i] = _used[j];
+      i = j;
+    }
+  }
+  _used[i] = kNone;
+  return b;
+}
+
+uint32_t SRAMheap::Alloc(size_t size) {
+  if (size == 0 || size > _size) {
+    _stats.failures++;
+    return SRAM_ALLOC_FAIL;
+  }
+  uint32_t units = (size + SRAM_HEAP_ALIGN - 1) / SRAM_HEAP_ALIGN;
+  uint16_t b = FindFree(units);
+  if (b == kNone) {
+    _stats.failures++;
+    return SRAM_ALLOC_FAIL;
+  }
+  RemoveFree(b);
+  return Take(b, units * SRAM_HEAP_ALIGN);
+}
+
+// Hands out block b, already off its free list, keeping want bytes. The tail
+// is split off unless we are out of descriptors, then just hand out more.
+uint32_t SRAMheap::Take(uint16_t b, uint32_t want) {
+  if (_blocks[b].size > want) {
+    uint16_t rest = NewBlock();
+    if (rest != kNone) {
+      Block &r = _blocks[rest];
+      r.address = _blocks[b].address + want;
+      r.size = _blocks[b].size - want;
+      r.prev_phys = b;
+      r.next_phys = _blocks[b].next_phys;
+      if (r.next_phys != kNone) _blocks[r.next_phys].prev_phys = rest;
+      _blocks[b].next_phys = rest;
+      _blocks[b].size = want;
+      InsertFree(rest);
+    }
+  }
+
+  HashInsert(b);
+  Block &blk = _blocks[b];
+  _stats.allocs++;
+  _stats.used_bytes += blk.size;
+  if (_stats.used_bytes > _stats.peak_used) _stats.peak_used = _stats.used_bytes;
+  if (blk.address + blk.size > _stats.high_water) _stats.high_water = blk.address + blk.size;
+  return blk.address;
+}
+
+// Allocates a given range, for data that is already in place (restored after
+// a reset). The range has to lie inside one free block; walks the block list.
+uint32_t SRAMheap::Claim(uint32_t address, size_t size) {
+  uint16_t b = _size ? _first : kNone;
+  while (b != kNone && _blocks[b].address + _blocks[b].size <= address) b = _blocks[b].next_phys;
+  uint32_t want = (size + SRAM_HEAP_ALIGN - 1) & ~(uint32_t)(SRAM_HEAP_ALIGN - 1);
+  if (size == 0 || address % SRAM_HEAP_ALIGN || b == kNone || !_blocks[b].free ||
+      address < _blocks[b].address || want > _blocks[b].address + _blocks[b].size - address) {
+    _stats.failures++;
+    return SRAM_ALLOC_FAIL;
+  }
+  if (address > _blocks[b].address) {         // the free head stays in b
+    uint16_t c = NewBlock();
+    if (c == kNone) {
+      _stats.failures++;
+      return SRAM_ALLOC_FAIL;
+    }
+    RemoveFree(b);
+    Block &blk = _blocks[c];
+    blk.address = address;
+    blk.size = _blocks[b].address + _blocks[b].size - address;
+    blk.free = false;
+    blk.prev_phys = b;
+    blk.next_phys = _blocks[b].next_phys;
+    if (blk.next_phys != kNone) _blocks[blk.next_phys].prev_phys = c;
+    _blocks[b].next_phys = c;
+    _blocks[b].size = address - _blocks[b].address;
+    InsertFree(b);
+    b = c;
+  } else {
+    RemoveFree(b);
+  }
+  return Take(b, want);
+}
+
+void SRAMheap::Free(uint32_t address) {
+  uint16_t b = HashRemove(address);
+  if (b == kNone) return;                   // not ours, or freed twice
+  _stats.frees++;
+  _stats.used_bytes -= _blocks[b].size;
+
+  uint16_t next = _blocks[b].next_phys;
+  if (next != kNone && _blocks[next].free) {
+    RemoveFree(next);
+    _blocks[b].size += _blocks[next].size;
+    _blocks[b].next_phys = _blocks[next].next_phys;
+    if (_blocks[b].next_phys != kNone) _blocks[_blocks[b].next_phys].prev_phys = b;
+    ReleaseBlock(next);
+  }
+  uint16_t prev = _blocks[b].prev_phys;
+  if (prev != kNone && _blocks[prev].free) {
+    RemoveFree(prev);
+    _blocks[prev].size += _blocks[b].size;
+    _blocks[prev].next_phys = _blocks[b].next_phys;
+    if (_blocks[prev].next_phys != kNone) _blocks[_blocks[prev].next_phys].prev_phys = prev;
+    ReleaseBlock(b);
+    b = prev;
+  }
+  InsertFree(b);
+}
+
+// Returns the end of a live allocation to the free space, merged with a free
+// neighbour after it. False when address is not allocated or size is larger.
+bool SRAMheap::Shrink(uint32_t address, size_t size) {
+  uint32_t i = (address / SRAM_HEAP_ALIGN) & (kHashSize - 1);
+  while (_used[i] != kNone && _blocks[_used[i]].address != address) i = (i + 1) & (kHashSize - 1);
+  uint16_t b = _used[i];
+  uint32_t want = (size + SRAM_HEAP_ALIGN - 1) & ~(uint32_t)(SRAM_HEAP_ALIGN - 1);
+  if (b == kNone || want == 0 || want > _blocks[b].size) return false;
+  if (want == _blocks[b].size) return true;
+  uint16_t rest = NewBlock();
+  if (rest == kNone) return false;
+  Block &r = _blocks[rest];
+  r.address = _blocks[b].address + want;
+  r.size = _blocks[b].size - want;
+  r.prev_phys = b;
+  r.next_phys = _blocks[b].next_phys;
+  if (r.next_phys != kNone) _blocks[r.next_phys].prev_phys = rest;
+  _blocks[b].next_phys = rest;
+  _blocks[b].size = want;
+  _stats.used_bytes -= r.size;
+
+  uint16_t next = r.next_phys;
+  if (next != kNone && _blocks[next].free) {
+    RemoveFree(next);
+    r.size += _blocks[next].size;
+    r.next_phys = _blocks[next].next_phys;
+    if (r.next_phys != kNone) _blocks[r.next_phys].prev_phys = rest;
+    ReleaseBlock(next);
+  }
+  InsertFree(rest);
+  return true;
+}
+
+uint32_t SRAMheap::SizeOf(uint32_t address) {
+  uint32_t i = (address / SRAM_HEAP_ALIGN) & (kHashSize - 1);
+  while (_used[i] != kNone) {
+    if (_blocks[_used[i]].address == address) return _blocks[_used[i]].size;
+    i = (i + 1) & (kHashSize - 1);
+  }
+  return 0;
+}
+
+// Walks the block list, so a snapshot can Claim the same ranges back
+size_t SRAMheap::Allocations(SRAMHeapRange *out, size_t max) {
+  size_t count = 0;
+  for (uint16_t b = _size ? _first : kNone; b != kNone && count < max; b = _blocks[b].next_phys) {
+    if (_blocks[b].free) continue;
+    out[count].address = _blocks[b].address;
+    out[count].size = _blocks[b].size;
+    count++;
+  }
+  return count;
+}
+
+// Walks the block list for the derived figures; not meant for hot paths
+SRAMHeapStats SRAMheap::Stats() {
+  SRAMHeapStats s = _stats;
+  s.free_bytes = _size - s.used_bytes;
+  s.largest_free = 0;
+  s.free_blocks = 0;
+  for (int fl = 0; fl < kFlCount; fl++) {
+    for (int sl = 0; sl < kSlCount; sl++) {
+      for (uint16_t b = _heads[fl][sl]; b != kNone; b = _blocks[b].next_free) {
+        s.free_blocks++;
+        if (_blocks[b].size > s.largest_free) s.largest_free = _blocks[b].size;
+      }
+    }
+  }
+  s.fragmentation = s.free_bytes ? 1000 - (uint32_t)((uint64_t)s.largest_free * 1000 / s.free_bytes) : 0;
+  return s;
+}
+
+bool SRAMheap::Check() {
+  if (_size == 0) return true;
+  uint32_t address = _base, used = 0;
+  uint16_t prev = kNone;
+  int count = 0;
+  for (uint16_t b = _first; b != kNone; prev = b, b = _blocks[b].next_phys) {
+    const Block &blk = _blocks[b];
+    if (blk.address != address || blk.prev_phys != prev || blk.size == 0) return false;
+    if (blk.free && prev != kNone && _blocks[prev].free) return false;      // missed a merge
+    if (!blk.free) used += blk.size;
+    address += blk.size;
+    if (++count > SRAM_HEAP_BLOCKS) return false;
+  }
+  return address == _base + _size && used == _stats.used_bytes;
+}
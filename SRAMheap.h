@@ -0,0 +1,95 @@
+/*  SRAMheap.h - Two-level segregated fit (TLSF) allocator for external SRAM.
+ *  Block descriptors live in a fixed pool in MCU RAM, so allocating and
+ *  freeing never touch the SPI bus. Free blocks are kept in size-class lists
+ *  indexed by two bitmaps, which makes both operations O(1); freed blocks are
+ *  merged with free neighbours straight away.
+ */
+
+#ifndef SRAMheap_h
+#define SRAMheap_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SRAM_HEAP_ALIGN
+#define SRAM_HEAP_ALIGN   32    // allocation granularity, a power of two; 32 = one page
+#endif
+#ifndef SRAM_HEAP_BLOCKS
+#define SRAM_HEAP_BLOCKS  256   // descriptors: live allocations plus free fragments, a power of two
+#endif
+
+#define SRAM_ALLOC_FAIL   0xFFFFFFFF
+
+struct SRAMHeapStats {
+  uint32_t used_bytes;                // allocated, rounded up to SRAM_HEAP_ALIGN
+  uint32_t free_bytes;
+  uint32_t peak_used;
+  uint32_t high_water;                // highest end address ever handed out
+  uint32_t largest_free;              // largest single free block
+  uint32_t free_blocks;               // number of free fragments
+  uint32_t fragmentation;             // 1000 * (1 - largest_free / free_bytes)
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t failures;                  // out of memory or out of descriptors
+};
+
+// One live allocation, as listed by Allocations
+struct SRAMHeapRange {
+  uint32_t address;
+  uint32_t size;                      // rounded up to SRAM_HEAP_ALIGN
+};
+
+class SRAMheap {
+  private:
+  static const uint16_t kNone = 0xFFFF;
+  static const int kSlLog = 2;                            // 4 lists per power of two
+  static const int kSlCount = 1 << kSlLog;
+  static const int kFlCount = 24;
+  static const uint32_t kHashSize = SRAM_HEAP_BLOCKS * 2;  // probed with & (kHashSize - 1)
+  static_assert((SRAM_HEAP_BLOCKS & (SRAM_HEAP_BLOCKS - 1)) == 0 && SRAM_HEAP_BLOCKS <= 0x8000,
+                "SRAM_HEAP_BLOCKS must be a power of two and fit the 16-bit descriptor index");
+
+  struct Block {
+    uint32_t address;
+    uint32_t size;
+    uint16_t prev_phys, next_phys;    // neighbours in address order
+    uint16_t prev_free, next_free;    // size-class list, or the spare descriptor chain
+    bool free;
+  };
+
+  Block _blocks[SRAM_HEAP_BLOCKS];
+  uint16_t _spare;                    // unused descriptors
+  uint16_t _first;                    // block at the base address
+  uint16_t _heads[kFlCount][kSlCount];
+  uint32_t _fl_bitmap;
+  uint32_t _sl_bitmap[kFlCount];
+  uint16_t _used[kHashSize];          // address -> descriptor of live allocations
+  uint32_t _base;
+  uint32_t _size;
+  SRAMHeapStats _stats;
+
+  static void Mapping(uint32_t units, int &fl, int &sl);
+  uint16_t NewBlock();
+  void ReleaseBlock(uint16_t b);
+  void InsertFree(uint16_t b);
+  void RemoveFree(uint16_t b);
+  uint16_t FindFree(uint32_t units);
+  uint32_t Take(uint16_t b, uint32_t want);
+  void HashInsert(uint16_t b);
+  uint16_t HashRemove(uint32_t address);
+
+  public:
+    SRAMheap();
+    void Begin(uint32_t base, uint32_t size);           // forgets every allocation
+    uint32_t Alloc(size_t size);                        // SRAM_ALLOC_FAIL when it cannot
+    void Free(uint32_t address);
+    uint32_t Claim(uint32_t address, size_t size);      // allocates exactly this range, if it is free
+    bool Shrink(uint32_t address, size_t size);         // frees the end of an allocation
+    uint32_t SizeOf(uint32_t address);                  // usable size of a live allocation
+    size_t Allocations(SRAMHeapRange *out, size_t max); // live allocations in address order; returns the count
+    uint32_t HighWater() { return _stats.high_water; }
+    SRAMHeapStats Stats();
+    bool Check();                                       // validates the block structure
+};
+
+#endif
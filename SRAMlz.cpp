@@ -0,0 +1,322 @@
+/*  SRAMlz.cpp - Compressed file storage in external SRAM.
+ *
+ *  A block is a list of sequences: a token byte (literal count in the high
+ *  nibble, match length - 4 in the low one), more literal count bytes when
+ *  the nibble is 15 (each adds up to 255), the literals, a 2-byte little
+ *  endian offset back into the output, and more match length bytes. The last
+ *  sequence has literals only.
+ */
+
+#include "SRAMlz.h"
+
+static const uint32_t kMinMatch = 4;
+static const uint32_t kHashSize = 1u << SRAM_LZ_HASH_LOG;
+
+static uint16_t match_table[kHashSize];              // position + 1 of the last 4 bytes with this hash
+
+static uint32_t Read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t Hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - SRAM_LZ_HASH_LOG);
+}
+
+// Extra length bytes for counts of 15 and more
+static uint8_t *PutLength(uint8_t *op, uint32_t length) {
+  for (length -= 15; length >= 255; length -= 255) *op++ = 255;
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+size_t SRAMlz::Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity){
+  uint8_t *op = dst;
+  uint8_t *end = dst + capacity;
+  size_t ip = 0, anchor = 0;
+  uint32_t misses = 0;
+  memset(match_table, 0, sizeof(match_table));
+  while (size >= kMinMatch && ip <= size - kMinMatch) {
+    uint32_t h = Hash4(Read32(src + ip));
+    size_t ref = match_table[h];
+    match_table[h] = (uint16_t)(ip + 1);
+    if (ref == 0 || ip - (ref - 1) > 0xFFFF || Read32(src + ref - 1) != Read32(src + ip)) {
+      ip += 1 + (misses++ >> 5);        // skip faster through data that does not compress
+      continue;
+    }
+    ref--;
+    misses = 0;
+    size_t length = kMinMatch;
+    while (ip + length < size && src[ref + length] == src[ip + length]) length++;
+
+    size_t literals = ip - anchor;
+    if (op + 1 + literals / 255 + 1 + literals + 2 + (length - kMinMatch) / 255 + 1 > end) return 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) op = PutLength(op, literals);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+    *op++ = (uint8_t)(ip - ref);
+    *op++ = (uint8_t)((ip - ref) >> 8);
+    length -= kMinMatch;
+    *token |= (uint8_t)(length < 15 ? length : 15);
+    if (length >= 15) op = PutLength(op, length);
+    ip += length + kMinMatch;
+    anchor = ip;
+  }
+
+  size_t literals = size - anchor;
+  if (op + 1 + literals / 255 + 1 + literals > end) return 0;
+  *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15) op = PutLength(op, literals);
+  memcpy(op, src + anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+size_t SRAMlz::Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity){
+  size_t ip = 0, op = 0;
+  while (ip < size) {
+    uint8_t token = src[ip++];
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do {
+        if (ip >= size) return 0;
+        b = src[ip++];
+        literals += b;
+      } while (b == 255);
+    }
+    if (literals > size - ip || literals > capacity - op) return 0;
+    memcpy(dst + op, src + ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == size) break;                        // the last sequence
+
+    if (size - ip < 2) return 0;
+    size_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15) {
+      uint8_t b;
+      do {
+        if (ip >= size) return 0;
+        b = src[ip++];
+        length += b;
+      } while (b == 255);
+    }
+    length += kMinMatch;
+    if (offset == 0 || offset > op || length > capacity - op) return 0;
+    const uint8_t *from = dst + op - offset;
+    if (offset >= length) {
+      memcpy(dst + op, from, length);
+    } else {
+      for (size_t i = 0; i < length; i++) dst[op + i] = from[i];   // overlapping: repeats a pattern
+    }
+    op += length;
+  }
+  return op;
+}
+
+// Allocates for the file stored raw, the worst case, and gives the unused
+// end back to the heap once the compressed size is known. The staging
+// buffers live in the work area, so nothing stays in static RAM between loads.
+bool SRAMlz::WriteFile(SRAMsimple& sram, const char *filepath, SRAMRegion *region, uint8_t *work){
+  uint8_t *owned = NULL;
+  if (work == NULL && (work = owned = (uint8_t *)malloc(SRAM_LZ_WORK)) == NULL) {
+    Serial.println("No room for the work area.");
+    return false;
+  }
+  bool ok = Write(sram, filepath, region, work);
+  free(owned);
+  return ok;
+}
+
+bool SRAMlz::Write(SRAMsimple& sram, const char *filepath, SRAMRegion *region, uint8_t *work){
+  uint32_t *load_index = (uint32_t *)work;
+  uint8_t *load_in = work + (SRAM_LZ_BLOCKS + 1) * 4;
+  uint8_t *load_out[2] = {load_in + SRAM_LZ_BLOCK, load_in + 2 * SRAM_LZ_BLOCK};
+  FILE *file = fopen(filepath, "r");
+  if (file == NULL) {
+    Serial.println("Failed to open file.");
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint32_t blocks = length > 0 ? (length + SRAM_LZ_BLOCK - 1) / SRAM_LZ_BLOCK : 0;
+  uint32_t address = blocks > 0 && blocks <= SRAM_LZ_BLOCKS ?
+                     sram.SRAMMalloc(length + (blocks + 1) * 4 + sizeof(SRAMLzTrailer)) : SRAM_ALLOC_FAIL;
+  if (address == SRAM_ALLOC_FAIL) {
+    fclose(file);
+    Serial.println("File does not fit in SRAM.");
+    return false;
+  }
+
+  uint32_t stored = 0, crc = 0, read = 0;
+#if DEVICE_SPI_ASYNCH
+  uint32_t pending[2] = {0, 0};
+#endif
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint8_t *out = load_out[b & 1];
+#if DEVICE_SPI_ASYNCH
+    if (pending[b & 1]) sram.AsyncWait(pending[b & 1]);
+#endif
+    size_t got = 0, n;
+    while (got < SRAM_LZ_BLOCK && (n = fread(load_in + got, 1, SRAM_LZ_BLOCK - got, file)) > 0) got += n;
+    if (got == 0) {
+      blocks = b;
+      break;
+    }
+    read += got;
+    n = SRAMlz::Compress(load_in, got, out, got - 1);
+    if (n == 0) {                                 // incompressible: store it
+      memcpy(out, load_in, got);
+      n = got;
+    }
+    crc = SRAMsimple::Crc32(crc, out, n);
+    load_index[b] = stored;
+#if DEVICE_SPI_ASYNCH
+    while ((pending[b & 1] = sram.WriteAsync(address + stored, out, n)) == 0) yield();
+#else
+    sram.SpiWriteByteArray(address + stored, out, n);
+#endif
+    stored += n;
+  }
+  fclose(file);
+  if (read != (uint32_t)length) {              // the file changed or a read failed
+#if DEVICE_SPI_ASYNCH
+    if (pending[0]) sram.AsyncWait(pending[0]);
+    if (pending[1]) sram.AsyncWait(pending[1]);
+#endif
+    sram.SRAMFree(address);
+    Serial.println("Failed to read file.");
+    return false;
+  }
+  load_index[blocks] = stored;
+
+  SRAMLzTrailer trailer = {(uint32_t)length, blocks, SRAM_LZ_BLOCK, SRAM_LZ_MAGIC};
+  crc = SRAMsimple::Crc32(crc, (const uint8_t *)load_index, (blocks + 1) * 4);
+  crc = SRAMsimple::Crc32(crc, (const uint8_t *)&trailer, sizeof(trailer));
+  sram.SpiWriteByteArray(address + stored, (const uint8_t *)load_index, (blocks + 1) * 4);
+  stored += (blocks + 1) * 4;
+  sram.SpiWriteByteArray(address + stored, (const uint8_t *)&trailer, sizeof(trailer));
+  stored += sizeof(trailer);
+  sram.SRAMShrink(address, stored);
+
+  region->address = address;
+  region->size = stored;
+  region->crc = crc;
+  return true;
+}
+
+/************ Reader ***************************/
+SRAMlzreader::SRAMlzreader(SRAMsimple& sram) : _sram(sram), _address(0), _size(0), _blocks(0),
+  _position(0), _current(kNoBlock), _ahead(kNoBlock)
+{
+}
+
+SRAMlzreader::~SRAMlzreader(){
+  Close();
+}
+
+bool SRAMlzreader::Open(const SRAMRegion &region){
+  SRAMLzTrailer trailer;
+  Close();
+  _size = 0;
+  _position = 0;
+  if (region.size < sizeof(trailer)) return false;
+  _sram.SpiReadByteArray(region.address + region.size - sizeof(trailer), sizeof(trailer), (uint8_t *)&trailer);
+  if (trailer.magic != SRAM_LZ_MAGIC || trailer.block != SRAM_LZ_BLOCK || trailer.blocks > SRAM_LZ_BLOCKS ||
+      (trailer.blocks + 1) * 4 + sizeof(trailer) > region.size) return false;
+  uint32_t data = region.size - sizeof(trailer) - (trailer.blocks + 1) * 4;
+  _sram.SpiReadByteArray(region.address + data, (trailer.blocks + 1) * 4, (uint8_t *)_index);
+  // A corrupt or stale index would make Fetch read past _packed
+  if (_index[0] != 0 || _index[trailer.blocks] > data ||
+      trailer.size > trailer.blocks * SRAM_LZ_BLOCK) return false;
+  for (uint32_t b = 0; b < trailer.blocks; b++) {
+    if (_index[b + 1] < _index[b] || _index[b + 1] - _index[b] > SRAM_LZ_BLOCK) return false;
+  }
+  _address = region.address;
+  _blocks = trailer.blocks;
+  _size = trailer.size;
+  return true;
+}
+
+void SRAMlzreader::Close(){
+#if DEVICE_SPI_ASYNCH
+  if (_ahead != kNoBlock) _sram.AsyncWait(_pending);  // the buffer belongs to us
+#endif
+  _ahead = kNoBlock;
+  _current = kNoBlock;
+}
+
+// Starts reading a block into its half of _packed; false when it would not fit
+bool SRAMlzreader::Fetch(uint32_t block){
+  uint8_t *packed = _packed[block & 1];
+  uint32_t n = _index[block + 1] - _index[block];
+  if (_index[block + 1] < _index[block] || n > SRAM_LZ_BLOCK) return false;
+#if DEVICE_SPI_ASYNCH
+  while ((_pending = _sram.ReadAsync(_address + _index[block], packed, n)) == 0) yield();
+#else
+  _sram.SpiReadByteArray(_address + _index[block], n, packed);
+#endif
+  _ahead = block;
+  return true;
+}
+
+bool SRAMlzreader::Load(uint32_t block){
+  if (block == _current) return true;
+  if (_ahead != block) {
+    Close();
+    if (!Fetch(block)) return false;
+  }
+#if DEVICE_SPI_ASYNCH
+  _sram.AsyncWait(_pending);
+#endif
+  _ahead = kNoBlock;
+  if (block + 1 < _blocks) Fetch(block + 1);     // on the bus while this one decodes
+
+  uint32_t stored = _index[block + 1] - _index[block];
+  uint32_t raw = _size - block * SRAM_LZ_BLOCK < SRAM_LZ_BLOCK ? _size - block * SRAM_LZ_BLOCK : SRAM_LZ_BLOCK;
+  const uint8_t *packed = _packed[block & 1];
+  if (stored == raw) memcpy(_data, packed, raw);
+  else if (SRAMlz::Decompress(packed, stored, _data, raw) != raw) return false;
+  _current = block;
+  return true;
+}
+
+bool SRAMlzreader::Seek(uint32_t offset){
+  if (offset > _size) return false;
+  _position = offset;
+  return true;
+}
+
+size_t SRAMlzreader::Next(const uint8_t **data){
+  if (_position >= _size) return 0;
+  uint32_t block = _position / SRAM_LZ_BLOCK;
+  if (!Load(block)) return 0;
+  uint32_t offset = _position % SRAM_LZ_BLOCK;
+  uint32_t end = _size - block * SRAM_LZ_BLOCK < SRAM_LZ_BLOCK ? _size - block * SRAM_LZ_BLOCK : SRAM_LZ_BLOCK;
+  *data = _data + offset;
+  _position += end - offset;
+  return end - offset;
+}
+
+size_t SRAMlzreader::Read(uint8_t *data, size_t size){
+  size_t done = 0;
+  while (done < size) {
+    const uint8_t *chunk;
+    uint32_t start = _position;
+    size_t n = Next(&chunk);
+    if (n == 0) break;
+    if (n > size - done) {
+      n = size - done;
+      _position = start + n;
+    }
+    memcpy(data + done, chunk, n);
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,93 @@
+/*  SRAMlz.h - Compressed file storage in external SRAM.
+ *  Files are cut into blocks of SRAM_LZ_BLOCK bytes, each compressed on its
+ *  own with an LZ4-style byte codec (literal runs and back-references, no
+ *  entropy coding), so it decodes fast on the MCU and any block can be read
+ *  without the ones before it. A block that does not shrink is stored as is.
+ *
+ *  Layout of a stored file: the blocks back to back, then the offset of each
+ *  block and of the end (blocks + 1 words), then a trailer. The trailer comes
+ *  last so the CRC of the region can be taken while it is written.
+ */
+
+#ifndef SRAMlz_h
+#define SRAMlz_h
+
+#include "SRAMsimple.h"
+
+#ifndef SRAM_LZ_BLOCK
+#define SRAM_LZ_BLOCK 4096      // uncompressed bytes per block, at most 65535
+#endif
+#if SRAM_LZ_BLOCK > 65535
+#error "SRAM_LZ_BLOCK must fit the 16-bit match table"
+#endif
+#ifndef SRAM_LZ_BLOCKS
+#define SRAM_LZ_BLOCKS 256      // largest index, in blocks
+#endif
+#ifndef SRAM_LZ_HASH_LOG
+#define SRAM_LZ_HASH_LOG 11     // match finder table of 2^n 16-bit entries, the only static RAM
+#endif
+// Work area of WriteFile: the block index, the block being read and the two
+// compressed blocks that take turns on the bus
+#define SRAM_LZ_WORK ((SRAM_LZ_BLOCKS + 1) * 4 + 3 * SRAM_LZ_BLOCK)
+#define SRAM_LZ_MAGIC 0x535A4C31   // "SZL1"
+
+struct SRAMLzTrailer {
+  uint32_t size;                      // uncompressed bytes
+  uint32_t blocks;
+  uint32_t block;                     // SRAM_LZ_BLOCK when it was written
+  uint32_t magic;
+};
+
+class SRAMlz {
+  private:
+  static bool Write(SRAMsimple& sram, const char *filepath, SRAMRegion *region, uint8_t *work);
+
+  public:
+    // Both return the bytes written to dst, or 0: Compress when the result
+    // would not fit in capacity, Decompress when src is corrupt
+    static size_t Compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+    static size_t Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity);
+    // The compressed counterpart of WriteFileInChunks. region receives the
+    // stored image (region->crc covers it, so SRAMsimple::Verify works on it).
+    // The write of each block overlaps reading and compressing the next.
+    // work is SRAM_LZ_WORK bytes, 4-byte aligned; without one it is taken
+    // from the MCU heap for the length of the call.
+    static bool WriteFile(SRAMsimple& sram, const char *filepath, SRAMRegion *region, uint8_t *work = NULL);
+};
+
+// Streams a stored file back, decompressing a block at a time; with async SPI
+// the next block is read while the current one is decompressed
+class SRAMlzreader {
+  private:
+  static const uint32_t kNoBlock = 0xFFFFFFFF;
+  SRAMsimple& _sram;
+  uint32_t _address;
+  uint32_t _size;                     // uncompressed
+  uint32_t _blocks;
+  uint32_t _index[SRAM_LZ_BLOCKS + 1];
+  uint32_t _position;
+  uint32_t _current;                  // block held in _data
+  uint32_t _ahead;                    // block being read into _packed, or kNoBlock
+#if DEVICE_SPI_ASYNCH
+  uint32_t _pending;
+#endif
+  uint8_t _packed[2][SRAM_LZ_BLOCK];
+  uint8_t _data[SRAM_LZ_BLOCK];
+
+  bool Fetch(uint32_t block);
+  bool Load(uint32_t block);
+
+  public:
+    SRAMlzreader(SRAMsimple& sram);
+    ~SRAMlzreader();
+    bool Open(const SRAMRegion &region);   // false when region holds no stored file
+    uint32_t Size() { return _size; }
+    uint32_t Remaining() { return _size - _position; }
+    bool Seek(uint32_t offset);
+    // Points data at the rest of the current block and moves past it; 0 at the end or on a corrupt block
+    size_t Next(const uint8_t **data);
+    size_t Read(uint8_t *data, size_t size);
+    void Close();
+};
+
+#endif
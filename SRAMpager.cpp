@@ -0,0 +1,173 @@
+/*  SRAMpager.cpp - Demand-paged view of external SRAM through frames in MCU RAM.
+ */
+
+#include "SRAMpager.h"
+
+SRAMpager::SRAMpager() : _sram(NULL), _base(0), _size(0), _frames(0), _hand(0)
+{
+  ResetStats();
+}
+
+SRAMpager::~SRAMpager(){
+  End();
+}
+
+void SRAMpager::ResetStats(){
+  memset(&stats, 0, sizeof(stats));
+}
+
+bool SRAMpager::Begin(SRAMsimple& sram, size_t size, uint8_t frames){
+  End();
+  size = (size + SRAM_PAGER_PAGE - 1) & ~(size_t)(SRAM_PAGER_PAGE - 1);
+  if (size == 0 || size / SRAM_PAGER_PAGE > SRAM_PAGER_PAGES) return false;
+  uint32_t base = sram.SRAMMalloc(size);
+  if (base == SRAM_ALLOC_FAIL) return false;
+  _sram = &sram;
+  _base = base;
+  _size = size;
+  _frames = frames == 0 || frames > SRAM_PAGER_FRAMES ? SRAM_PAGER_FRAMES : frames;
+  _hand = 0;
+  memset(_table, kNone, sizeof(_table));
+  memset(_frame, 0, sizeof(_frame));
+  ResetStats();
+  return true;
+}
+
+void SRAMpager::End(){
+  if (!_sram) return;
+  Flush();
+  _sram->SRAMFree(_base);
+  _sram = NULL;
+  _size = 0;
+}
+
+// Dirty chip pages go out as runs, one sequential burst per run
+void SRAMpager::WriteBack(uint8_t f){
+  Frame &frame = _frame[f];
+  uint32_t dirty = frame.dirty;
+  uint32_t address = _base + frame.page * SRAM_PAGER_PAGE;
+  while (dirty) {
+    uint32_t first = __builtin_ctz(dirty);
+    uint32_t rest = ~(dirty >> first);
+    uint32_t run = rest ? __builtin_ctz(rest) : 32 - first;
+    _sram->SpiWriteByteArray(address + first * SRAM_PAGE_SIZE, _data[f] + first * SRAM_PAGE_SIZE, run * SRAM_PAGE_SIZE);
+    dirty &= run < 32 ? ~(((1u << run) - 1) << first) : 0;
+  }
+  frame.dirty = 0;
+  stats.writebacks++;
+}
+
+// Clock: sweep from the hand, giving referenced frames a second chance.
+// Two full turns clear every reference bit, so finding nothing means every
+// frame is pinned. The page is only read when fill is set.
+uint8_t SRAMpager::Fault(uint32_t page, bool fill){
+  uint32_t start = micros();
+  uint8_t f = kNone;
+  for (int step = 0; step < 2 * _frames; step++) {
+    Frame &frame = _frame[_hand];
+    uint8_t at = _hand;
+    _hand = (_hand + 1) % _frames;
+    if (frame.pins) continue;
+    if (frame.valid && frame.referenced) {
+      frame.referenced = false;
+      continue;
+    }
+    f = at;
+    break;
+  }
+  if (f == kNone) return kNone;
+
+  Frame &frame = _frame[f];
+  if (frame.valid) {
+    stats.evictions++;
+    if (frame.dirty) WriteBack(f);
+    _table[frame.page] = kNone;
+  }
+  if (fill) _sram->SpiReadByteArray(_base + page * SRAM_PAGER_PAGE, SRAM_PAGER_PAGE, _data[f]);
+  frame.page = page;
+  frame.dirty = 0;
+  frame.pins = 0;
+  frame.referenced = true;
+  frame.valid = true;
+  _table[page] = f;
+  stats.faults++;
+  stats.fault_us += micros() - start;
+  return f;
+}
+
+uint8_t SRAMpager::Map(uint32_t page, bool fill){
+  stats.accesses++;
+  uint8_t f = _table[page];
+  if (f == kNone) return Fault(page, fill);
+  _frame[f].referenced = true;
+  return f;
+}
+
+uint8_t *SRAMpager::Pin(uint32_t address, bool write){
+  if (address >= _size) return NULL;
+  uint8_t f = Map(address / SRAM_PAGER_PAGE, true);
+  if (f == kNone) return NULL;
+  _frame[f].pins++;
+  if (write) _frame[f].dirty = (uint32_t)(~0ull >> (64 - SRAM_PAGER_PAGE / SRAM_PAGE_SIZE));   // 1 to 32 chip pages
+  return _data[f] + address % SRAM_PAGER_PAGE;
+}
+
+void SRAMpager::Unpin(uint32_t address){
+  if (address >= _size) return;
+  uint8_t f = _table[address / SRAM_PAGER_PAGE];
+  if (f != kNone && _frame[f].pins) _frame[f].pins--;
+}
+
+// Only for pages that are mapped, i.e. pinned by the caller
+void SRAMpager::MarkDirty(uint32_t address, size_t size){
+  while (size > 0 && address < _size) {
+    uint32_t offset = address % SRAM_PAGER_PAGE;
+    size_t n = SRAM_PAGER_PAGE - offset < size ? SRAM_PAGER_PAGE - offset : size;
+    uint8_t f = _table[address / SRAM_PAGER_PAGE];
+    if (f != kNone) {
+      uint32_t first = offset / SRAM_PAGE_SIZE;
+      uint32_t last = (offset + n - 1) / SRAM_PAGE_SIZE;
+      _frame[f].dirty |= (~0u >> (31 - last)) & (~0u << first);
+    }
+    address += n;
+    size -= n;
+  }
+}
+
+bool SRAMpager::Read(uint32_t address, uint8_t *data, size_t size){
+  if (address > _size || size > _size - address) return false;
+  while (size > 0) {
+    uint32_t offset = address % SRAM_PAGER_PAGE;
+    size_t n = SRAM_PAGER_PAGE - offset < size ? SRAM_PAGER_PAGE - offset : size;
+    uint8_t f = Map(address / SRAM_PAGER_PAGE, true);
+    if (f == kNone) return false;
+    memcpy(data, _data[f] + offset, n);
+    address += n;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// A write covering a whole page does not read it in first
+bool SRAMpager::Write(uint32_t address, const uint8_t *data, size_t size){
+  if (address > _size || size > _size - address) return false;
+  while (size > 0) {
+    uint32_t offset = address % SRAM_PAGER_PAGE;
+    size_t n = SRAM_PAGER_PAGE - offset < size ? SRAM_PAGER_PAGE - offset : size;
+    uint8_t f = Map(address / SRAM_PAGER_PAGE, n < SRAM_PAGER_PAGE);
+    if (f == kNone) return false;
+    memcpy(_data[f] + offset, data, n);
+    MarkDirty(address, n);
+    address += n;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+void SRAMpager::Flush(){
+  for (uint8_t f = 0; f < _frames; f++) {
+    if (_frame[f].valid && _frame[f].dirty) WriteBack(f);
+  }
+}
@@ -0,0 +1,92 @@
+/*  SRAMpager.h - Demand-paged view of external SRAM through frames in MCU RAM.
+ *  A virtual space of Begin(size) bytes is backed by one heap region of the
+ *  chip. Pin() maps the page holding an address into a frame and returns a
+ *  plain pointer to it, which stays valid until Unpin(). Frames are replaced
+ *  with the clock algorithm, skipping pinned ones, and dirty frames are
+ *  written back one chip page (SRAM_PAGE_SIZE) run at a time, so untouched
+ *  parts of a frame are never rewritten.
+ */
+
+#ifndef SRAMpager_h
+#define SRAMpager_h
+
+#include "SRAMsimple.h"
+
+#ifndef SRAM_PAGER_PAGE
+#define SRAM_PAGER_PAGE 1024    // bytes per page, a power of two from 1 to 32 chip pages
+#endif
+#ifndef SRAM_PAGER_FRAMES
+#define SRAM_PAGER_FRAMES 16    // frames in MCU RAM, at most 255
+#endif
+#ifndef SRAM_PAGER_PAGES
+#define SRAM_PAGER_PAGES (SRAM_SIZE * SRAM_MAX_CHIPS / SRAM_PAGER_PAGE)   // page table entries
+#endif
+
+#if SRAM_PAGER_PAGE < SRAM_PAGE_SIZE || SRAM_PAGER_PAGE > 32 * SRAM_PAGE_SIZE
+#error "SRAM_PAGER_PAGE: the dirty mask has one bit per chip page"
+#endif
+#if (SRAM_PAGER_PAGE & (SRAM_PAGER_PAGE - 1)) != 0
+#error "SRAM_PAGER_PAGE must be a power of two: sizes and addresses are rounded with masks"
+#endif
+#if SRAM_PAGER_FRAMES > 255
+#error "SRAM_PAGER_FRAMES: frame 255 would be the empty-entry marker"
+#endif
+
+struct SRAMPagerStats {
+  uint32_t accesses;                  // Pin calls, including those made by Read/Write
+  uint32_t faults;                    // pages that had to be brought in
+  uint32_t evictions;                 // faults that replaced a page
+  uint32_t writebacks;                // evicted or flushed frames that were dirty
+  uint32_t fault_us;                  // time spent in faults, write-back included
+};
+
+class SRAMpager {
+  private:
+  static const uint8_t kNone = 0xFF;
+
+  struct Frame {
+    uint32_t page;
+    uint32_t dirty;                   // one bit per chip page
+    uint16_t pins;
+    bool referenced;                  // clock bit
+    bool valid;
+  };
+
+  SRAMsimple *_sram;
+  uint32_t _base;                     // SRAM address of virtual address 0
+  uint32_t _size;
+  uint8_t _frames;                    // frames in use, up to SRAM_PAGER_FRAMES
+  uint8_t _hand;
+  uint8_t _table[SRAM_PAGER_PAGES];   // page -> frame
+  Frame _frame[SRAM_PAGER_FRAMES];
+  uint8_t _data[SRAM_PAGER_FRAMES][SRAM_PAGER_PAGE];
+
+  uint8_t Fault(uint32_t page, bool fill);
+  void WriteBack(uint8_t f);
+  uint8_t Map(uint32_t page, bool fill);
+
+  public:
+    SRAMPagerStats stats;
+    SRAMpager();
+    ~SRAMpager();
+    // Takes size bytes (rounded up to whole pages) from the heap; frames
+    // limits the frame pool below SRAM_PAGER_FRAMES, for sizing it
+    bool Begin(SRAMsimple& sram, size_t size, uint8_t frames = SRAM_PAGER_FRAMES);
+    void End();                       // writes back and returns the region to the heap
+    // Pointer to address, valid up to the end of its page until Unpin. With
+    // write set the whole page is marked dirty. NULL when every frame is pinned.
+    uint8_t *Pin(uint32_t address, bool write = false);
+    void Unpin(uint32_t address);
+    void MarkDirty(uint32_t address, size_t size);   // finer than Pin(address, true)
+    // Copies through unpinned frames; false when no frame could be mapped
+    bool Read(uint32_t address, uint8_t *data, size_t size);
+    bool Write(uint32_t address, const uint8_t *data, size_t size);
+    void Flush();                     // writes back every dirty frame
+    uint32_t Size() { return _size; }
+    // Faults per 1000 accesses, and the mean cost of one
+    uint32_t FaultRate() { return stats.accesses ? (uint32_t)((uint64_t)stats.faults * 1000 / stats.accesses) : 0; }
+    uint32_t FaultLatency() { return stats.faults ? stats.fault_us / stats.faults : 0; }
+    void ResetStats();
+};
+
+#endif
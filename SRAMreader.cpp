@@ -0,0 +1,150 @@
+/*  SRAMreader.cpp - Sequential read stream over a region of a SRAMsimple chip.
+ */
+
+#include "SRAMreader.h"
+
+SRAMreader::SRAMreader(SRAMsimple& sram) : _sram(sram), _size(0), _unrequested(0), _delivered(0),
+  _requested(0), _filled(0), _consumed(0), _busy(false), _failed(false), _open(false), _held(false),
+  _cur(NULL), _cur_left(0)
+{
+}
+
+SRAMreader::~SRAMreader(){
+  Close();
+}
+
+void SRAMreader::Open(uint32_t address, uint32_t size){
+  Close();
+  _size = size;
+  _unrequested = size;
+  _delivered = 0;
+  _requested = 0;
+  _filled = 0;
+  _consumed = 0;
+  _held = false;
+  _failed = false;
+  _cur_left = 0;
+  _sram.SetMode(Sequential);          // the read runs on past page boundaries
+  _sram.BeginFastRead(address);
+  _open = true;
+  Prefetch(false);
+}
+
+void SRAMreader::Open(const SRAMRegion &region){
+  Open(region.address, region.size);
+}
+
+// Starts the transfer of the next chunk when its slot is free and the bus is
+// idle. The payload keeps clocking the open HSREAD, so there is no command
+// or address to resend. Moving to the next chip takes a blocking write, so
+// it is left to thread context. Without async SPI, and on SQI or hardware
+// NSS where every read is a complete command, the chunk is read
+// synchronously instead.
+void SRAMreader::Prefetch(bool in_irq){
+#if DEVICE_SPI_ASYNCH
+  if (!_sram.Framed()) {
+    // Only the claim on the bus is taken with interrupts off: the chip change
+    // (NextSegment, a blocking SPI::write that locks the bus mutex) must stay
+    // outside the critical section. The async SPI::transfer takes no mutex and
+    // may be started with interrupts masked, as QueueAsync does. Once _busy is
+    // set the interrupt side leaves the state alone.
+    bool start = false;
+    core_util_critical_section_enter();
+    if (_open && !_busy && !_failed && _unrequested > 0 && _requested - _consumed < SRAM_READER_SLOTS &&
+        (_sram._stream_left > 0 || !in_irq)) {
+      _busy = true;
+      start = true;
+    }
+    core_util_critical_section_exit();
+    if (!start) return;
+    if (_sram._stream_left == 0) _sram.NextSegment();
+    size_t n = _unrequested < SRAM_READER_CHUNK ? _unrequested : SRAM_READER_CHUNK;
+    if (n > _sram._stream_left) n = _sram._stream_left;
+    uint32_t slot = _requested % SRAM_READER_SLOTS;
+    _chunk_size[slot] = n;
+    _unrequested -= n;
+    _sram._stream_left -= n;
+    _sram._stream_address = (_sram._stream_address + n) % _sram._size;
+#if SRAM_STATS
+    _sram._stream_bytes += n;
+#endif
+    _requested = _requested + 1;
+    _sram._spi->transfer((const char *)NULL, 0, (char *)_ring[slot], n,
+                        callback(this, &SRAMreader::FillDone), SPI_EVENT_ALL);
+    return;
+  }
+#endif
+  if (_open && _unrequested > 0 && _requested - _consumed < SRAM_READER_SLOTS) {
+    size_t n = _unrequested < SRAM_READER_CHUNK ? _unrequested : SRAM_READER_CHUNK;
+    uint32_t slot = _requested % SRAM_READER_SLOTS;
+    _sram.ReadBytes(_ring[slot], n);
+    _chunk_size[slot] = n;
+    _unrequested -= n;
+    _requested = _requested + 1;
+    _filled = _requested;
+  }
+}
+
+// Completion of a chunk transfer, in interrupt context: chain the next one.
+// After an error the slot holds garbage, so the stream stops there.
+void SRAMreader::FillDone(int event){
+  if (!(event & SPI_EVENT_COMPLETE) || (event & SPI_EVENT_ERROR)) {
+    _failed = true;
+    _busy = false;
+    return;
+  }
+  _filled = _filled + 1;
+  _busy = false;
+  Prefetch(true);
+}
+
+size_t SRAMreader::Next(const uint8_t **data){
+  if (!_open) return 0;
+  if (_held) {
+    _held = false;
+    _cur_left = 0;
+    _consumed++;
+    Prefetch(false);
+  }
+  if (_delivered == _size) return 0;
+  while (_filled <= _consumed) {
+    if (_failed) return 0;
+    Prefetch(false);                  // picks up a chip change the interrupt left behind
+    yield();
+  }
+  uint32_t slot = _consumed % SRAM_READER_SLOTS;
+  _held = true;
+  _delivered += _chunk_size[slot];
+  *data = _ring[slot];
+  return _chunk_size[slot];
+}
+
+size_t SRAMreader::Read(uint8_t *data, size_t size){
+  size_t done = 0;
+  while (done < size) {
+    if (_cur_left == 0) {
+      size_t n = Next(&_cur);
+      if (n == 0) break;
+      _cur_left = n;
+    }
+    size_t n = size - done < _cur_left ? size - done : _cur_left;
+    memcpy(data + done, _cur, n);
+    _cur += n;
+    _cur_left -= n;
+    done += n;
+  }
+  return done;
+}
+
+// Bytes the caller has not yet been handed
+uint32_t SRAMreader::Remaining(){
+  if (!_open) return 0;
+  return _size - _delivered + _cur_left;
+}
+
+void SRAMreader::Close(){
+  if (!_open) return;
+  while (_busy) yield();              // let a prefetch in flight finish before CS goes high
+  _sram.EndTransaction();
+  _open = false;
+}
@@ -0,0 +1,61 @@
+/*  SRAMreader.h - Sequential read stream over a region of a SRAMsimple chip.
+ *  Open() sends one HSREAD command and keeps CS low until Close(), so the
+ *  region is read as a single transaction however many chunks it takes.
+ *  With async SPI the next chunks are prefetched into a ring buffer in MCU
+ *  RAM while the caller works on the current one. On a multi-chip
+ *  SRAMsimple chunks end at segment boundaries, where the read is reopened
+ *  on the next chip.
+ */
+
+#ifndef SRAMreader_h
+#define SRAMreader_h
+
+#include "SRAMsimple.h"
+
+#ifndef SRAM_READER_SLOTS
+#define SRAM_READER_SLOTS 2     // ring buffer chunks: one with the caller, the rest prefetching
+#endif
+#ifndef SRAM_READER_CHUNK
+#define SRAM_READER_CHUNK 512   // bytes per chunk
+#endif
+
+class SRAMreader {
+  private:
+  SRAMsimple& _sram;
+  uint8_t _ring[SRAM_READER_SLOTS][SRAM_READER_CHUNK];
+  size_t _chunk_size[SRAM_READER_SLOTS];
+  uint32_t _size;                     // bytes in the region
+  uint32_t _unrequested;              // bytes no transfer has been started for
+  uint32_t _delivered;                // bytes handed to the caller
+  volatile uint32_t _requested;       // chunks whose transfer has started
+  volatile uint32_t _filled;          // chunks whose transfer has finished
+  uint32_t _consumed;                 // chunks handed back by the caller
+  volatile bool _busy;                // a chunk transfer is on the bus
+  volatile bool _failed;              // a chunk transfer reported an error
+  bool _open;
+  bool _held;                         // the caller has chunk _consumed
+  const uint8_t *_cur;                // unread part of the held chunk, for Read()
+  size_t _cur_left;
+
+  void Prefetch(bool in_irq);
+  void FillDone(int event);
+
+  public:
+    SRAMreader(SRAMsimple& sram);
+    ~SRAMreader();
+    // The reader owns the bus from Open() to Close(): no other SRAMsimple
+    // call may run in between. Open() switches the chip to sequential mode.
+    void Open(uint32_t address, uint32_t size);
+    void Open(const SRAMRegion &region);
+    // Next chunk of the region, or 0 at the end or after a failed
+    // transfer (see Failed()). The data stays valid until
+    // the following Next() or Read(), which hand the slot back for prefetch.
+    size_t Next(const uint8_t **data);
+    // Copies the next size bytes, crossing chunks; returns the bytes copied
+    size_t Read(uint8_t *data, size_t size);
+    uint32_t Remaining();
+    bool Failed() { return _failed; }
+    void Close();
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*  SRAMring.cpp - Single-producer, single-consumer FIFO stored in external SRAM.
+ */
+
+#include "SRAMring.h"
+
+SRAMring::SRAMring() : _sram(NULL), _base(0), _capacity(0), _head(0), _tail(0), _stage_head(0), _stage_tail(0)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+SRAMring::~SRAMring(){
+  End();
+}
+
+bool SRAMring::Begin(SRAMsimple& sram, size_t capacity){
+  End();
+  if (capacity < SRAM_PAGE_SIZE) return false;
+  uint32_t size = 1u << (31 - __builtin_clz((uint32_t)capacity));
+  uint32_t base = sram.SRAMMalloc(size);
+  if (base == SRAM_ALLOC_FAIL) return false;
+  _sram = &sram;
+  _base = base;
+  _capacity = size;
+  _head = 0;
+  _tail = 0;
+  _stage_head.store(0);
+  _stage_tail.store(0);
+  memset(&stats, 0, sizeof(stats));
+  return true;
+}
+
+void SRAMring::End(){
+  if (_sram) _sram->SRAMFree(_base);
+  _sram = NULL;
+  _capacity = 0;
+}
+
+bool SRAMring::Push(const void *data, size_t size){
+  uint32_t head = _stage_head.load(std::memory_order_relaxed);
+  uint32_t tail = _stage_tail.load(std::memory_order_acquire);
+  if (size > SRAM_RING_STAGE - (head - tail)) {
+    stats.dropped++;
+    return false;
+  }
+  uint32_t at = head % SRAM_RING_STAGE;
+  size_t first = SRAM_RING_STAGE - at < size ? SRAM_RING_STAGE - at : size;
+  memcpy(_stage + at, data, first);
+  memcpy(_stage, (const uint8_t *)data + first, size - first);
+  _stage_head.store(head + size, std::memory_order_release);
+  stats.pushed++;
+  return true;
+}
+
+// Writes size staged bytes at _head: one transaction per side of the ring's
+// wrap point, each fed from up to two pieces of the staging ring
+void SRAMring::Move(uint32_t size){
+  uint32_t from = _stage_tail.load(std::memory_order_relaxed);
+  while (size > 0) {
+    uint32_t at = _head % _capacity;
+    uint32_t n = _capacity - at < size ? _capacity - at : size;
+    _sram->BeginWrite(_base + at);
+    for (uint32_t left = n; left > 0; ) {
+      uint32_t s = from % SRAM_RING_STAGE;
+      uint32_t piece = SRAM_RING_STAGE - s < left ? SRAM_RING_STAGE - s : left;
+      _sram->WriteBytes(_stage + s, piece);
+      from += piece;
+      left -= piece;
+    }
+    _sram->EndTransaction();
+    stats.bursts++;
+    _head += n;
+    size -= n;
+  }
+  _stage_tail.store(from, std::memory_order_release);
+}
+
+size_t SRAMring::Flush(bool force){
+  if (!_sram) return 0;
+  uint32_t staged = _stage_head.load(std::memory_order_acquire) - _stage_tail.load(std::memory_order_relaxed);
+  uint32_t room = _capacity - (_head - _tail);
+  uint32_t n = staged < room ? staged : room;
+  if (!force) n -= (_head + n) % SRAM_PAGE_SIZE <= n ? (_head + n) % SRAM_PAGE_SIZE : n;   // end on a page boundary
+  if (n == 0) return 0;
+  Move(n);
+  stats.flushed += n;
+  return n;
+}
+
+bool SRAMring::Pop(void *data, size_t size){
+  if (!_sram || size > Available()) return false;
+  if (_head - _tail < size) Flush(true);
+  if (_head - _tail < size) return false;       // the chip side is full of older data
+  uint8_t *out = (uint8_t *)data;
+  while (size > 0) {
+    uint32_t at = _tail % _capacity;
+    uint32_t n = _capacity - at < size ? _capacity - at : size;
+    _sram->SpiReadByteArray(_base + at, n, out);
+    _tail += n;
+    out += n;
+    size -= n;
+  }
+  return true;
+}
+
+uint32_t SRAMring::Available(){
+  return (_head - _tail) + (_stage_head.load(std::memory_order_acquire) - _stage_tail.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,61 @@
+/*  SRAMring.h - Single-producer, single-consumer FIFO stored in external SRAM.
+ *  Push() only copies into a staging ring in MCU RAM, so it never touches the
+ *  bus and is safe from an interrupt handler. Flush() moves staged bytes to
+ *  the chip in bursts that end on chip page boundaries, so small records are
+ *  coalesced instead of costing a transaction each; Pop() reads them back.
+ *  Flush and Pop use the bus and belong to the consumer thread. A transfer
+ *  that wraps around the end of the ring is at most two transactions.
+ */
+
+#ifndef SRAMring_h
+#define SRAMring_h
+
+#include <atomic>
+#include "SRAMsimple.h"
+
+#ifndef SRAM_RING_STAGE
+#define SRAM_RING_STAGE 512     // staging bytes in MCU RAM, a power of two
+#endif
+
+struct SRAMRingStats {
+  uint32_t pushed;                    // records accepted
+  uint32_t dropped;                   // records refused: staging area full
+  uint32_t bursts;                    // write transactions made by Flush
+  uint32_t flushed;                   // bytes moved to the chip
+};
+
+class SRAMring {
+  private:
+  SRAMsimple *_sram;
+  uint32_t _base;
+  uint32_t _capacity;                 // a power of two
+  uint32_t _head;                     // bytes ever flushed to the chip
+  uint32_t _tail;                     // bytes ever popped
+  std::atomic<uint32_t> _stage_head;  // bytes ever pushed; written by the producer only
+  std::atomic<uint32_t> _stage_tail;  // bytes ever flushed from staging; consumer only
+  uint8_t _stage[SRAM_RING_STAGE];
+  static_assert((SRAM_RING_STAGE & (SRAM_RING_STAGE - 1)) == 0,
+                "SRAM_RING_STAGE must be a power of two: the staging offsets are taken from wrapping counters");
+
+  void Move(uint32_t size);
+
+  public:
+    SRAMRingStats stats;
+    SRAMring();
+    ~SRAMring();
+    // Takes capacity bytes from the heap, rounded down to a power of two
+    bool Begin(SRAMsimple& sram, size_t capacity);
+    void End();
+    // Producer side, interrupt safe. All or nothing; false when the staging
+    // area cannot take the record, which is then counted as dropped.
+    bool Push(const void *data, size_t size);
+    // Consumer side. Flush writes the whole pages staged, or with force
+    // everything that fits; it returns the bytes moved. Pop takes exactly
+    // size bytes, flushing first if the chip holds fewer.
+    size_t Flush(bool force = false);
+    bool Pop(void *data, size_t size);
+    uint32_t Available();             // bytes that Pop can return, staged ones included
+    uint32_t Capacity() { return _capacity; }
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*  SRAMscheduler.cpp - Thread-safe front end for a SRAMsimple shared by RTOS threads.
+ */
+
+#include "SRAMscheduler.h"
+
+SRAMscheduler::SRAMscheduler(SRAMsimple& sram, osPriority_t priority) : _sram(sram), _wake(0),
+  _owner(priority), _stop(false), _running(false), _chunks(0)
+{
+  for (int p = 0; p < SRAM_PRIO_CLASSES; p++) {
+    _inbox[p].store(NULL);
+    _head[p] = NULL;
+    _tail[p] = NULL;
+    _completed[p].store(0);
+  }
+}
+
+SRAMscheduler::~SRAMscheduler(){
+  Stop();
+}
+
+void SRAMscheduler::Start(){
+  if (_running) return;
+  _running = true;
+  _owner.start(callback(this, &SRAMscheduler::Run));
+}
+
+void SRAMscheduler::Stop(){
+  if (!_running) return;
+  _stop.store(true);
+  _wake.release();
+  _owner.join();
+  _running = false;
+}
+
+// Producers push onto a lock-free stack with compare-and-swap; the owner takes
+// the whole stack in one exchange, so there is no ABA problem
+void SRAMscheduler::Submit(SRAMRequest &req){
+  req.done = 0;
+  req.queued_us = micros();
+  uint8_t p = req.priority < SRAM_PRIO_CLASSES ? req.priority : SRAM_PRIO_BULK;
+  SRAMRequest *head = _inbox[p].load(std::memory_order_relaxed);
+  do {
+    req.next = head;
+  } while (!_inbox[p].compare_exchange_weak(head, &req, std::memory_order_release, std::memory_order_relaxed));
+  _wake.release();
+}
+
+void SRAMscheduler::Wait(SRAMRequest &req){
+  req.finished.acquire();
+}
+
+void SRAMscheduler::Read(uint32_t address, uint8_t *data, size_t size, uint8_t priority){
+  SRAMRequest req;
+  req.op = READ;
+  req.address = address;
+  req.data = data;
+  req.size = size;
+  req.priority = priority;
+  Submit(req);
+  Wait(req);
+}
+
+void SRAMscheduler::Write(uint32_t address, const uint8_t *data, size_t size, uint8_t priority){
+  SRAMRequest req;
+  req.op = WRITE;
+  req.address = address;
+  req.data = (uint8_t *)data;
+  req.size = size;
+  req.priority = priority;
+  Submit(req);
+  Wait(req);
+}
+
+// Moves newly submitted requests to the owner's FIFOs, oldest first
+void SRAMscheduler::Collect(){
+  for (int p = 0; p < SRAM_PRIO_CLASSES; p++) {
+    SRAMRequest *list = _inbox[p].exchange(NULL, std::memory_order_acquire);
+    SRAMRequest *fifo = NULL;
+    while (list) {                    // reverse the stack
+      SRAMRequest *next = list->next;
+      list->next = fifo;
+      fifo = list;
+      list = next;
+    }
+    if (!fifo) continue;
+    if (_tail[p]) _tail[p]->next = fifo;
+    else _head[p] = fifo;
+    while (fifo->next) fifo = fifo->next;
+    _tail[p] = fifo;
+  }
+}
+
+// The owner: serve the highest priority class with work, one chunk at a time,
+// and collect new requests in between. A latency request that is not done
+// goes to the back of its queue, so a large one cannot hold up the small
+// ones behind it for more than a chunk.
+void SRAMscheduler::Run(){
+  for (;;) {
+    Collect();
+    int p = 0;
+    while (p < SRAM_PRIO_CLASSES && !_head[p]) p++;
+    if (p == SRAM_PRIO_CLASSES) {
+      if (_stop.load()) return;
+      _wake.acquire();
+      continue;
+    }
+    SRAMRequest *req = _head[p];
+    size_t n = req->size - req->done;
+    if (n > SRAM_SCHED_CHUNK) n = SRAM_SCHED_CHUNK;
+    if (req->op == (uint32_t)WRITE) _sram.SpiWriteByteArray(req->address + req->done, req->data + req->done, n);
+    else _sram.SpiReadByteArray(req->address + req->done, n, req->data + req->done);
+    req->done += n;
+    if (req->size > SRAM_SCHED_CHUNK) _chunks.fetch_add(1, std::memory_order_relaxed);
+    if (req->done < req->size) {
+      if (p == SRAM_PRIO_LATENCY && req->next) {
+        _head[p] = req->next;
+        req->next = NULL;
+        _tail[p]->next = req;
+        _tail[p] = req;
+      }
+      continue;
+    }
+
+    _head[p] = req->next;
+    if (!_head[p]) _tail[p] = NULL;
+    _completed[p].fetch_add(1, std::memory_order_relaxed);
+    req->done_us = micros();
+    req->finished.release();          // the submitter may reuse req from here on
+  }
+}
@@ -0,0 +1,69 @@
+/*  SRAMscheduler.h - Thread-safe front end for a SRAMsimple shared by RTOS threads.
+ *  One owner thread performs every transfer. Other threads hand it requests
+ *  through lock-free multi-producer queues, one per priority class, and
+ *  block until their request has been served. Latency requests always go
+ *  first. Every request runs in chunks of SRAM_SCHED_CHUNK bytes, so a large
+ *  copy never holds the bus for long, and a large latency request takes
+ *  turns with the others of its class.
+ */
+
+#ifndef SRAMscheduler_h
+#define SRAMscheduler_h
+
+#include <atomic>
+#include "SRAMsimple.h"
+
+#define SRAM_PRIO_LATENCY 0     // small, latency-critical accesses
+#define SRAM_PRIO_BULK    1     // loads and copies, served between latency requests
+#define SRAM_PRIO_CLASSES 2
+
+#ifndef SRAM_SCHED_CHUNK
+#define SRAM_SCHED_CHUNK 2048   // bytes of a request moved before other requests get a turn
+#endif
+
+// One queued transfer, owned by the submitting thread until it completes
+struct SRAMRequest {
+  uint32_t op;                        // WRITE or READ
+  uint32_t address;
+  uint8_t *data;
+  size_t size;
+  uint8_t priority;
+  size_t done;                        // bytes moved so far
+  uint32_t queued_us;                 // micros() at Submit
+  uint32_t done_us;                   // micros() at completion
+  rtos::Semaphore finished;
+  SRAMRequest *next;
+};
+
+class SRAMscheduler {
+  private:
+  SRAMsimple& _sram;
+  std::atomic<SRAMRequest *> _inbox[SRAM_PRIO_CLASSES];   // pushed by any thread, newest first
+  SRAMRequest *_head[SRAM_PRIO_CLASSES];                  // owner-side FIFOs
+  SRAMRequest *_tail[SRAM_PRIO_CLASSES];
+  rtos::Semaphore _wake;
+  rtos::Thread _owner;
+  std::atomic<bool> _stop;
+  bool _running;
+  std::atomic<uint32_t> _completed[SRAM_PRIO_CLASSES];     // written by the owner, read by anyone
+  std::atomic<uint32_t> _chunks;
+
+  void Collect();
+  void Run();
+
+  public:
+    SRAMscheduler(SRAMsimple& sram, osPriority_t priority = osPriorityAboveNormal);
+    ~SRAMscheduler();
+    void Start();                     // once; an mbed thread cannot be restarted
+    void Stop();                      // serves what is queued, then ends the owner thread
+    // Blocking transfers; safe from any thread except the owner
+    void Read(uint32_t address, uint8_t *data, size_t size, uint8_t priority = SRAM_PRIO_LATENCY);
+    void Write(uint32_t address, const uint8_t *data, size_t size, uint8_t priority = SRAM_PRIO_LATENCY);
+    // Split-phase form: req must stay valid until Wait returns
+    void Submit(SRAMRequest &req);
+    void Wait(SRAMRequest &req);
+    uint32_t Completed(uint8_t priority) { return priority < SRAM_PRIO_CLASSES ? _completed[priority].load(std::memory_order_relaxed) : 0; }
+    uint32_t Chunks() { return _chunks.load(std::memory_order_relaxed); }   // pieces of requests larger than a chunk
+};
+
+#endif
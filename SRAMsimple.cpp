@@ -9,531 +9,1401 @@
 #include "SRAMsimple.h"
 
 using namespace mbed;
-#define CS 0x80
 
-SRAMsimple::SRAMsimple(SPI& spi_param) : _spi(spi_param)
+SRAMsimple * SRAMsimple::_inst = NULL;
+
+#if SRAM_TRACE
+#define SRAM_TRACE_CMD(command, length) Trace(command, length)
+#define SRAM_TRACE_DATA(bytes) (_trace[(_trace_count - 1) % SRAM_TRACE_DEPTH].length += (bytes))
+#else
+#define SRAM_TRACE_CMD(command, length) ((void)0)
+#define SRAM_TRACE_DATA(bytes) ((void)0)
+#endif
+
+#if SRAM_STATS
+#define SRAM_STATS_START(var) uint32_t var = SRAM_STATS_CLOCK()
+#define SRAM_STATS_RECORD(op, bytes, start) Record(op, bytes, start)
+#define SRAM_STATS_COUNT(field) (_stats.field++)
+#define SRAM_STATS_BYTES(bytes) (_stream_bytes += (bytes))
+#else
+#define SRAM_STATS_START(var) ((void)0)
+#define SRAM_STATS_RECORD(op, bytes, start) ((void)0)
+#define SRAM_STATS_COUNT(field) ((void)0)
+#define SRAM_STATS_BYTES(bytes) ((void)0)
+#endif
+
+bool SRAMsimple::cycle_counter = false;
+
+SRAMsimple::SRAMsimple(SPI& spi_param, uint8_t cs_mode) : _spi(&spi_param)
+#if DEVICE_QSPI
+  , _qspi(NULL)
+#endif
+#if DEVICE_SPI_ASYNCH
+  , _async_issued(0), _async_completed(0)
+#endif
+{
+  _cs[0] = SRAM_CS_PIN;
+  _chips = 1;
+  _layout = SRAM_CONCAT;
+  InitSelect(cs_mode);
+  Init();
+}
+
+SRAMsimple::SRAMsimple(SPI& spi_param, const uint32_t *cs_pins, uint8_t chips, uint8_t layout, uint8_t cs_mode) : _spi(&spi_param)
+#if DEVICE_QSPI
+  , _qspi(NULL)
+#endif
+#if DEVICE_SPI_ASYNCH
+  , _async_issued(0), _async_completed(0)
+#endif
+{
+  if (chips > SRAM_MAX_CHIPS) chips = SRAM_MAX_CHIPS;
+  for (uint8_t i = 0; i < chips; i++) _cs[i] = cs_pins[i];
+  _chips = chips ? chips : 1;
+  _layout = layout;
+  InitSelect(_chips > 1 && cs_mode == SRAM_CS_HARDWARE ? SRAM_CS_GPIO : cs_mode);
+  Init();
+}
+
+#if DEVICE_QSPI
+// RSTIO on 4 lanes first, in case the chip was left in SQI mode by an earlier
+// run (a chip in SPI mode ignores it), then EQIO on one lane
+SRAMsimple::SRAMsimple(QSPI& qspi_param) : _spi(NULL), _qspi(&qspi_param)
+#if DEVICE_SPI_ASYNCH
+  , _async_issued(0), _async_completed(0)
+#endif
+{
+  _cs[0] = SRAM_CS_PIN;
+  _chips = 1;
+  _layout = SRAM_CONCAT;
+  InitSelect(SRAM_CS_HARDWARE);
+  _qspi->set_frequency(60000000);
+  _qspi->configure_format(QSPI_CFG_BUS_QUAD, QSPI_CFG_BUS_QUAD, QSPI_CFG_ADDR_SIZE_24, QSPI_CFG_BUS_QUAD,
+                          QSPI_CFG_ALT_SIZE_8, QSPI_CFG_BUS_QUAD, 0);
+  _qspi->command_transfer(RSTIO >> 24, -1, NULL, 0, NULL, 0);
+  _qspi->configure_format(QSPI_CFG_BUS_SINGLE, QSPI_CFG_BUS_SINGLE, QSPI_CFG_ADDR_SIZE_24, QSPI_CFG_BUS_SINGLE,
+                          QSPI_CFG_ALT_SIZE_8, QSPI_CFG_BUS_SINGLE, 0);
+  _qspi->command_transfer(EQIO >> 24, -1, NULL, 0, NULL, 0);
+  _qspi_dummy = -1;
+  QuadFormat(0);
+  Init();
+}
+#endif
+
+void SRAMsimple::Init()
 {
+  _inst = this;
+  _size = (uint32_t)_chips * SRAM_SIZE;
+  _heap.Begin(0, _size);
+  model_data.address = 0;
+  model_data.size = 0;
+  model_data.crc = 0;
+  memset(&load_stats, 0, sizeof(load_stats));
+  memset(&scrub_stats, 0, sizeof(scrub_stats));
+  _crc_block = 0;
+  _scrub_next = 0;
+  memset(&snapshot_stats, 0, sizeof(snapshot_stats));
+  memset(_snap_dirty, 0, sizeof(_snap_dirty));
+  _snap_generation = 0;
   // SPI _spi(PC_3, PC_2, PI_1);           // MOSI,MISO,SCK, (CS not added here as it results in unexpected behaviour)
-  _spi.frequency(60000000);             // Set up your frequency.
-  _spi.format(32, 0);  // Message length (bits), SPI_MODE - check these in your SPI decice's data sheet.
+  if (_spi) {
+    _spi->frequency(60000000);             // Set up your frequency.
+    _spi->format(32, 0);  // Message length (bits), SPI_MODE - check these in your SPI decice's data sheet.
+  }
+  _frame_bits = 32;
+#if SRAM_TRACE
+  TraceClear();
+#endif
+#if SRAM_STATS
+  ResetStats();
+#endif
+#if (SRAM_TRACE || SRAM_STATS) && defined(DWT)
+  // Without a debugger attached nothing has enabled trace, and the M7 also
+  // keeps the DWT locked; a counter that stays frozen would put every
+  // latency in bucket 0, so make sure it runs or fall back to us_ticker.
+  // The counter is shared with profilers and RTOS trace: it is only started
+  // when stopped and never reset, as only differences of it are used.
+  if (!(CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk)) CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+#if defined(__CORTEX_M) && (__CORTEX_M == 7)
+    DWT->LAR = 0xC5ACCE55;
+#endif
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+  uint32_t cycles = DWT->CYCCNT;
+  for (volatile int i = 0; i < 16; i++) {}
+  cycle_counter = DWT->CYCCNT != cycles;
+#endif
+  ReadMode();                           // learn the mode the chips are in
+}
+SRAMsimple::~SRAMsimple(){
+  for (uint8_t i = 0; i < SRAM_MAX_CHIPS; i++) delete _cs_out[i];
+}
+
+// Sets up the chip selects for the backend and leaves every chip deselected
+void SRAMsimple::InitSelect(uint8_t cs_mode)
+{
+  _cs_mode = cs_mode;
+  for (uint8_t i = 0; i < SRAM_MAX_CHIPS; i++) _cs_out[i] = NULL;
+  if (cs_mode == SRAM_CS_HARDWARE) return;
+  for (uint8_t i = 0; i < _chips; i++) {
+    switch (cs_mode) {
+    case SRAM_CS_GPIO:
+      gpio_init_out_ex(&_cs_gpio[i], (PinName)_cs[i], 1);
+      break;
+    case SRAM_CS_DIGITALOUT:
+      _cs_out[i] = new DigitalOut((PinName)_cs[i], 1);
+      break;
+    default:
+      pinMode(_cs[i], OUTPUT);
+      digitalWrite(_cs[i], HIGH);
+      break;
+    }
+  }
+}
+
+uint32_t SRAMsimple::Size(){
+  return _size;
+}
+
+bool SRAMsimple::Quad(){
+#if DEVICE_QSPI
+  return _qspi != NULL;
+#else
+  return false;
+#endif
+}
+
+bool SRAMsimple::Framed(){
+  return _cs_mode == SRAM_CS_HARDWARE;
+}
+
+#if DEVICE_QSPI
+/************ SQI transport ***************************/
+// All phases run on 4 lanes. The QSPI peripheral drives CS and sends the
+// instruction and address itself, so each call is one complete command.
+void SRAMsimple::QuadFormat(int dummy){
+  if (_qspi_dummy == dummy) return;
+  _qspi->configure_format(QSPI_CFG_BUS_QUAD, QSPI_CFG_BUS_QUAD, QSPI_CFG_ADDR_SIZE_24, QSPI_CFG_BUS_QUAD,
+                          QSPI_CFG_ALT_SIZE_8, QSPI_CFG_BUS_QUAD, dummy);
+  _qspi_dummy = dummy;
+}
+
+// op is WRITE or READ; address is a chip address
+void SRAMsimple::QuadTransfer(uint32_t op, uint32_t address, const uint8_t *tx, uint8_t *rx, size_t size){
+  size_t length = size;
+  SRAM_STATS_COUNT(transactions);
+  if (op == (uint32_t)WRITE) {
+    QuadFormat(0);
+    _qspi->write(WRITE >> 24, -1, address, (const char *)tx, &length);
+  } else {
+    QuadFormat(SRAM_SQI_READ_DUMMY);
+    _qspi->read(READ >> 24, -1, address, (char *)rx, &length);
+  }
+}
+#endif
+
+// Linear address to chip and address inside the chip
+uint32_t SRAMsimple::Map(uint32_t address, uint8_t *chip){
+  address %= _size;
+  if (_layout == SRAM_STRIPE) {
+    uint32_t stripe = address / SRAM_STRIPE_SIZE;
+    *chip = stripe % _chips;
+    return (stripe / _chips) * SRAM_STRIPE_SIZE + address % SRAM_STRIPE_SIZE;
+  }
+  *chip = address / SRAM_SIZE;
+  return address % SRAM_SIZE;
+}
+
+// Bytes from address to the end of its segment, the run that stays on one chip
+uint32_t SRAMsimple::Span(uint32_t address){
+  address %= _size;
+  if (_layout == SRAM_STRIPE && _chips > 1) return SRAM_STRIPE_SIZE - address % SRAM_STRIPE_SIZE;
+  return SRAM_SIZE - address % SRAM_SIZE;
+}
+
+// Word commands run on 32-bit frames and block transfers on 8-bit frames.
+// format() reprograms the peripheral, so only call it when the width changes.
+void SRAMsimple::FrameBits(int bits){
+#if DEVICE_SPI_ASYNCH
+  AsyncFlush();                       // blocking calls never cut into a queued transfer
+#endif
+  if (_spi && _frame_bits != bits) {
+    _spi->format(bits, 0);
+    _frame_bits = bits;
+  }
+}
+
+// Splits a 32-bit opcode|address command into the 4 bytes sent on the wire
+void SRAMsimple::PackCommand(char *out, uint32_t command){
+  out[0] = (char)(command >> 24);
+  out[1] = (char)(command >> 16);
+  out[2] = (char)(command >> 8);
+  out[3] = (char)command;
 }
-SRAMsimple::~SRAMsimple(){/*nothing to destruct*/}
 
 // byte CS=PI_0; // default CS global variable
 
 /*  Set up the memory chip to either single byte or sequence of bytes mode **********/
+// The mode is cached, so repeating SetMode costs no bus traffic
 void SRAMsimple::SetMode(uint32_t Mode){            // Select for single or multiple byte transfer
   
-  digitalWrite(CS,LOW);
-  _spi.write((uint32_t)WRSR | Mode); // command to write to Status register
-  digitalWrite(CS,HIGH);
+  uint8_t mode = (uint8_t)(Mode >> 16) & 0xC0;
+  if (mode == _mode) return;
+  SRAM_STATS_COUNT(mode_switches);
+#if DEVICE_QSPI
+  if (Quad()) {
+    char status = (char)(Mode >> 16);
+    SRAM_TRACE_CMD((uint32_t)WRSR | Mode, 0);
+    SRAM_STATS_COUNT(transactions);
+    QuadFormat(0);                      // command_transfer also clocks the configured dummy cycles
+    _qspi->command_transfer(WRSR >> 24, -1, &status, 1, NULL, 0);
+    _mode = mode;
+    return;
+  }
+#endif
+  FrameBits(32);
+  for (uint8_t chip = 0; chip < _chips; chip++) {
+    SRAM_TRACE_CMD((uint32_t)WRSR | Mode, 0);
+    ChipSelect select(*this, chip);
+    _spi->write((uint32_t)WRSR | Mode); // command to write to Status register
+  }
+  _mode = mode;
 }
 
-void SRAMsimple::ReadMode(){            // Select for single or multiple byte transfer
+// Reads the status register of every chip. The cache only takes the mode
+// when all chips agree on a valid one; otherwise the next SetMode rewrites it.
+uint8_t SRAMsimple::ReadMode(){
   uint32_t read_word;
-  digitalWrite(CS,LOW);
-  read_word = _spi.write((uint32_t) RDSR); // 1 Byte instruction + 3 Byte Wait cycles
-  digitalWrite(CS,HIGH);
-  read_word = (uint16_t) (read_word >> 8 ); 
-  
+  uint8_t mode = SRAM_MODE_UNKNOWN;
+#if DEVICE_QSPI
+  if (Quad()) {
+    char status = 0;
+    SRAM_TRACE_CMD((uint32_t)RDSR, 1);
+    SRAM_STATS_COUNT(transactions);
+    QuadFormat(0);
+    _qspi->command_transfer(RDSR >> 24, -1, NULL, 0, &status, 1);
+    mode = (uint8_t)status & 0xC0;
+    _mode = mode == 0xC0 ? SRAM_MODE_UNKNOWN : mode;
+    return _mode;
+  }
+#endif
+  FrameBits(32);
+  for (uint8_t chip = 0; chip < _chips; chip++) {
+    SRAM_TRACE_CMD((uint32_t)RDSR, 1);
+    {
+      ChipSelect select(*this, chip);
+      read_word = _spi->write((uint32_t) RDSR); // 1 Byte instruction + 3 Byte Wait cycles
+    }
+    uint8_t status = (uint8_t)(read_word >> 16) & 0xC0;   // first byte after the instruction
+    if (chip == 0) mode = status;
+    else if (status != mode) mode = SRAM_MODE_UNKNOWN;
+  }
+  _mode = mode == 0xC0 ? SRAM_MODE_UNKNOWN : mode;
+  return _mode;
+}
+
+// Makes sure one command can move size bytes from address (size 0: unknown).
+// Byte mode serves single bytes, page mode runs that stay inside a page and
+// sequential mode anything, so the current mode is kept whenever it fits and
+// only otherwise the chips go to sequential, which then fits every request.
+void SRAMsimple::EnsureMode(uint32_t address, size_t size){
+  uint8_t page = (uint8_t)(PageMode >> 16);
+  if (_mode == (uint8_t)(Sequential >> 16)) return;
+  if (size == 1 && _mode != SRAM_MODE_UNKNOWN) return;
+  if (size > 0 && _mode == page && address % SRAM_PAGE_SIZE + size <= SRAM_PAGE_SIZE) return;
+  SetMode(Sequential);
 }
 
 /************ Byte transfer functions ***************************/
 void SRAMsimple::WriteWord(uint32_t address, uint32_t data_byte) {
   
-  digitalWrite(CS, LOW);                         // set SPI slave select LOW;
-  _spi.write((uint32_t)WRITE | address);
-  _spi.write((uint32_t)data_byte);                      // write the data to the memory location
-  digitalWrite(CS, HIGH);  
+  if (Span(address) < 4 || Framed()) {          // the word straddles two chips, or one call per command
+    uint8_t bytes[4] = {(uint8_t)(data_byte >> 24), (uint8_t)(data_byte >> 16), (uint8_t)(data_byte >> 8), (uint8_t)data_byte};
+    SpiWriteByteArray(address, bytes, 4);
+    return;
+  }
+  SRAM_STATS_START(start);
+  EnsureMode(address, 4);
+  Dirty(address, 4);
+  uint8_t chip;
+  uint32_t local = Map(address, &chip);
+  FrameBits(32);
+  SRAM_TRACE_CMD((uint32_t)WRITE | address, 4);
+  {
+    ChipSelect select(*this, chip);
+    _spi->write((uint32_t)WRITE | local);
+    _spi->write((uint32_t)data_byte);                      // write the data to the memory location
+  }
+  SRAM_STATS_RECORD(SRAM_STAT_WORD_WRITE, 4, start);
 
+#if SRAM_TRACE >= 2
   Serial.print("Writing the value at");
   Serial.print(address);
   Serial.print(" : ");
   Serial.println((uint32_t)data_byte);   
+#endif
 }
 
 uint32_t SRAMsimple::ReadWord(uint32_t address) {
   
   uint32_t read_word;
-  digitalWrite(CS,LOW);
-  _spi.write((uint32_t)READ | address);// 1 Byte instruction
-  read_word = _spi.write((uint32_t)0);
-  digitalWrite(CS,HIGH);
+  if (Span(address) < 4 || Framed()) {          // the word straddles two chips, or one call per command
+    uint8_t bytes[4];
+    SpiReadByteArray(address, 4, bytes);
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+  }
+  SRAM_STATS_START(start);
+  EnsureMode(address, 4);
+  uint8_t chip;
+  uint32_t local = Map(address, &chip);
+  FrameBits(32);
+  SRAM_TRACE_CMD((uint32_t)READ | address, 4);
+  {
+    ChipSelect select(*this, chip);
+    _spi->write((uint32_t)READ | local);// 1 Byte instruction
+    read_word = _spi->write((uint32_t)0);
+  }
+  SRAM_STATS_RECORD(SRAM_STAT_WORD_READ, 4, start);
 
+#if SRAM_TRACE >= 2
   Serial.print("Reading the value at");
   Serial.print(address);
   Serial.print(" : ");
   Serial.println((uint32_t)read_word);
+#endif
   // read_word = (uint8_t) (read_word >> 24 ); //Data recieved MSB first
   
   return read_word;                              // send data back to the calling function
 }
 
-// SPI SRAM Malloc
+// SPI SRAM Malloc. The heap bookkeeping is all in MCU RAM, no bus traffic.
+// Returns SRAM_ALLOC_FAIL when no free block is large enough.
 uint32_t SRAMsimple::SRAMMalloc(size_t size) {
-    if (SRAM_ADDR + size >= SRAM_SIZE) {
-        // No more memory available in external SRAM
-        return 0xFFFFFFFF; 
+    uint32_t address = _heap.Alloc(size);
+    if (address == SRAM_ALLOC_FAIL) SRAM_STATS_COUNT(alloc_failures);
+    return address;
+}
+
+void SRAMsimple::SRAMFree(uint32_t address) {
+    _heap.Free(address);
+}
+
+uint32_t SRAMsimple::SRAMClaim(uint32_t address, size_t size) {
+    return _heap.Claim(address, size);
+}
+
+bool SRAMsimple::SRAMShrink(uint32_t address, size_t size) {
+    return _heap.Shrink(address, size);
+}
+
+SRAMHeapStats SRAMsimple::HeapStats() {
+    return _heap.Stats();
+}
+/************ Streaming transactions ***************************/
+// One READ or WRITE command with CS held low across any number of
+// ReadBytes/WriteBytes calls, each a single buffered SPI::write on 8-bit frames.
+// With several chips the transaction is reopened on the next chip whenever
+// the data runs past the end of a segment.
+void SRAMsimple::BeginTransaction(uint32_t op, uint32_t address, size_t size)
+{
+#if SRAM_STATS
+    _stream_start = SRAM_STATS_CLOCK();
+    _stream_bytes = 0;
+#endif
+    EnsureMode(address, size);
+    _stream_op = op;
+    _stream_address = address % _size;
+    FrameBits(8);
+    OpenSegment();
+}
+
+// Sends the command for the segment holding _stream_address. HSREAD takes a
+// dummy byte after the address; it goes out with the header.
+void SRAMsimple::OpenSegment()
+{
+    char header[5];
+    uint32_t local = Map(_stream_address, &_stream_chip);
+    _stream_left = Span(_stream_address);
+    PackCommand(header, _stream_op | local);
+    header[4] = 0;
+    SRAM_TRACE_CMD(_stream_op | _stream_address, 0);
+    if (Framed()) return;               // SQI and hardware NSS send a command with every data call
+    Select(_stream_chip);
+    _spi->write(header, _stream_op == (uint32_t)HSREAD ? 5 : 4, NULL, 0);
+}
+
+void SRAMsimple::NextSegment()
+{
+    if (!Framed()) Deselect(_stream_chip);
+    OpenSegment();
+}
+
+void SRAMsimple::BeginWrite(uint32_t address)
+{
+    BeginTransaction((uint32_t)WRITE, address, 0);
+}
+
+void SRAMsimple::BeginRead(uint32_t address)
+{
+    BeginTransaction((uint32_t)READ, address, 0);
+}
+
+void SRAMsimple::BeginFastRead(uint32_t address)
+{
+    BeginTransaction((uint32_t)HSREAD, address, 0);
+}
+
+void SRAMsimple::WriteBytes(const uint8_t *data, size_t size)
+{
+    while (size) {
+        if (_stream_left == 0) NextSegment();
+        size_t n = size < _stream_left ? size : _stream_left;
+#if DEVICE_QSPI
+        if (Quad()) QuadTransfer((uint32_t)WRITE, _stream_address % SRAM_SIZE, data, NULL, n);
+        else
+#endif
+        if (Framed()) FramedTransfer(_stream_op, _stream_address % SRAM_SIZE, data, NULL, n);
+        else _spi->write((const char *)data, n, NULL, 0);
+        Dirty(_stream_address, n);
+        SRAM_TRACE_DATA(n);
+        SRAM_STATS_BYTES(n);
+        data += n;
+        size -= n;
+        _stream_left -= n;
+        _stream_address = (_stream_address + n) % _size;
+    }
+}
+
+void SRAMsimple::ReadBytes(uint8_t *data, size_t size)
+{
+    while (size) {
+        if (_stream_left == 0) NextSegment();
+        size_t n = size < _stream_left ? size : _stream_left;
+#if DEVICE_QSPI
+        if (Quad()) QuadTransfer((uint32_t)READ, _stream_address % SRAM_SIZE, NULL, data, n);
+        else
+#endif
+        if (Framed()) FramedTransfer(_stream_op, _stream_address % SRAM_SIZE, NULL, data, n);
+        else _spi->write(NULL, 0, (char *)data, n);     // clocks out the default write value
+        SRAM_TRACE_DATA(n);
+        SRAM_STATS_BYTES(n);
+        data += n;
+        size -= n;
+        _stream_left -= n;
+        _stream_address = (_stream_address + n) % _size;
     }
+}
 
-    uint32_t allocated_address = SRAM_ADDR;
-    SRAM_ADDR += size;
-    return allocated_address;
+void SRAMsimple::EndTransaction()
+{
+    if (!Framed()) Deselect(_stream_chip);
+    SRAM_STATS_RECORD(_stream_op == (uint32_t)WRITE ? SRAM_STAT_WRITE : SRAM_STAT_READ, _stream_bytes, _stream_start);
 }
-// Writes a byte array into SRAM at a specific location
-void SRAMsimple::SpiWriteByteArray(uint32_t address, uint8_t *data, size_t size)
-{  
-    digitalWrite(CS,LOW);
-    spi.write((uint8_t)WRITE);
-    spi.write((uint8_t)((address >> 16)& 0xFF));
-    spi.write((uint8_t)((address >> 8)& 0xFF));
-    spi.write((uint8_t)address);
-    for(size_t i=0;i<size;i++)
-    {
-      spi.write(data[i]);
+
+// Hardware NSS rises after every SPI call, so each piece goes out as its own
+// command: the header and up to SRAM_NSS_STAGE - 5 bytes in one buffer.
+// Reads clock the data in behind the header. Only single-chip setups get here.
+void SRAMsimple::FramedTransfer(uint32_t op, uint32_t address, const uint8_t *tx, uint8_t *rx, size_t size)
+{
+    size_t header = op == (uint32_t)HSREAD ? 5 : 4;
+    while (size) {
+        size_t n = size < SRAM_NSS_STAGE - header ? size : SRAM_NSS_STAGE - header;
+        SRAM_STATS_COUNT(transactions);
+        PackCommand((char *)_nss_stage, op | address);
+        _nss_stage[4] = 0;                            // HSREAD dummy byte
+        if (tx) {
+            memcpy(_nss_stage + header, tx, n);
+            _spi->write((const char *)_nss_stage, header + n, NULL, 0);
+            tx += n;
+        } else {
+            char command[5];
+            memcpy(command, _nss_stage, header);
+            _spi->write(command, header, (char *)_nss_stage, header + n);
+            memcpy(rx, _nss_stage + header, n);
+            rx += n;
+        }
+        size -= n;
+        address = (address + n) % SRAM_SIZE;
     }
-    
-    digitalWrite(CS,HIGH);
 }
-//uint16_t value;
+
+// Writes a byte array into SRAM at a specific location.
+// Command and payload each go out as one buffered SPI::write, so the driver
+// is entered twice per call instead of once per byte.
+void SRAMsimple::SpiWriteByteArray(uint32_t address, const uint8_t *data, size_t size)
+{  
+    SRAMtransaction transaction(*this, (uint32_t)WRITE, address, size);
+    transaction.Write(data, size);
+}
 
 // Reads bytes into an array
-void SRAMsimple::SpiReadByteArray(uint32_t address, uint16_t size, uint8_t* readarray)
+void SRAMsimple::SpiReadByteArray(uint32_t address, size_t size, uint8_t* readarray)
 {
+    SRAMtransaction transaction(*this, (uint32_t)READ, address, size);
+    transaction.Read(readarray, size);
+}
 
-    
-    digitalWrite(CS,LOW);
-    spi.write((uint8_t)READ);
-    spi.write((uint8_t)((address >> 16)& 0xFF));
-    spi.write((uint8_t)((address >> 8)& 0xFF));
-    spi.write((uint8_t)address);
-    for(int i=0;i<size;i++)
-    {
-      readarray[i] = spi.write((uint8_t)0);
+/************ Scatter/gather ***************************/
+// Insertion sort: batches are small, and it keeps equal addresses in order
+void SRAMsimple::SortIoVec(SRAMIoVec *vec, size_t count)
+{
+    for (size_t i = 1; i < count; i++) {
+        SRAMIoVec item = vec[i];
+        size_t j = i;
+        while (j > 0 && vec[j - 1].address > item.address) {
+            vec[j] = vec[j - 1];
+            j--;
+        }
+        vec[j] = item;
     }
-    digitalWrite(CS,HIGH);
-    
 }
 
-// Reads file in SD card in chunks into a buffer and writes it into the SD card
-void SRAMsimple::WriteFileInChunks(const char* filepath, size_t chunk_size = 32*100) {
-    
-    FILE *file = fopen(filepath, "r");
+// A run of ranges goes out as one READ. Gaps up to SRAM_GATHER_GAP bytes are
+// read through, which is cheaper than a new command. Small ranges and the
+// gaps before them are read in groups of up to SRAM_GATHER_BUFFER bytes into
+// a stack buffer and copied out, so a group costs one driver call; larger
+// ranges go straight into the caller's buffer.
+size_t SRAMsimple::ReadV(SRAMIoVec *vec, size_t count)
+{
+    uint8_t stage[SRAM_GATHER_BUFFER];
+    size_t bursts = 0;
+    SortIoVec(vec, count);
+    for (size_t first = 0; first < count; ) {
+        size_t last = first;
+        uint32_t end = vec[first].address + vec[first].size;
+        while (last + 1 < count && vec[last + 1].address >= end && vec[last + 1].address - end <= SRAM_GATHER_GAP) {
+            last++;
+            end = vec[last].address + vec[last].size;
+        }
+        uint32_t pos = vec[first].address;
+        BeginTransaction((uint32_t)READ, pos, end - pos);
+        for (size_t i = first; i <= last; ) {
+            if (vec[i].address + vec[i].size - pos > SRAM_GATHER_BUFFER) {
+                while (pos < vec[i].address) {                  // the gap before a large range
+                    uint32_t n = vec[i].address - pos < SRAM_GATHER_BUFFER ? vec[i].address - pos : SRAM_GATHER_BUFFER;
+                    ReadBytes(stage, n);
+                    pos += n;
+                }
+                ReadBytes(vec[i].data, vec[i].size);
+                pos += vec[i].size;
+                i++;
+                continue;
+            }
+            size_t group = i;
+            uint32_t group_end = vec[i].address + vec[i].size;
+            while (group + 1 <= last && vec[group + 1].address + vec[group + 1].size - pos <= SRAM_GATHER_BUFFER) {
+                group++;
+                group_end = vec[group].address + vec[group].size;
+            }
+            ReadBytes(stage, group_end - pos);
+            for (; i <= group; i++) memcpy(vec[i].data, stage + (vec[i].address - pos), vec[i].size);
+            pos = group_end;
+        }
+        EndTransaction();
+        bursts++;
+        first = last + 1;
+    }
+    return bursts;
+}
+
+// Writes cannot skip bytes, so only ranges that touch are merged. Small
+// ranges are packed into the stack buffer and sent together.
+size_t SRAMsimple::WriteV(SRAMIoVec *vec, size_t count)
+{
+    uint8_t stage[SRAM_GATHER_BUFFER];
+    size_t bursts = 0;
+    SortIoVec(vec, count);
+    for (size_t first = 0; first < count; ) {
+        size_t last = first;
+        uint32_t end = vec[first].address + vec[first].size;
+        while (last + 1 < count && vec[last + 1].address == end) {
+            last++;
+            end += vec[last].size;
+        }
+        BeginTransaction((uint32_t)WRITE, vec[first].address, end - vec[first].address);
+        size_t staged = 0;
+        for (size_t i = first; i <= last; i++) {
+            if (staged + vec[i].size > SRAM_GATHER_BUFFER) {
+                WriteBytes(stage, staged);
+                staged = 0;
+            }
+            if (vec[i].size > SRAM_GATHER_BUFFER) {
+                WriteBytes(vec[i].data, vec[i].size);
+            } else {
+                memcpy(stage + staged, vec[i].data, vec[i].size);
+                staged += vec[i].size;
+            }
+        }
+        WriteBytes(stage, staged);
+        EndTransaction();
+        bursts++;
+        first = last + 1;
+    }
+    return bursts;
+}
 
-    // Buffer to hold each chunk
-    uint8_t buffer[chunk_size];
+/************ Copy, move and fill ***************************/
+// The chip has no copy command, so data goes through MCU RAM in chunks of
+// SRAM_LOADER_CHUNK bytes using the loader's buffers. With async SPI the read
+// of each chunk and its write are queued back to back while the other buffer
+// is still in the queue, so the bus runs without gaps; the queue keeps them
+// in order, so a write never starts before its read has filled the buffer.
+void SRAMsimple::CopyChunks(uint32_t dst, uint32_t src, size_t size, bool backward)
+{
+#if DEVICE_SPI_ASYNCH
+    uint32_t pending[SRAM_LOADER_BUFFERS] = {0};   // write still using each buffer
+#endif
+    size_t done = 0;
+    for (int slot = 0; done < size; slot = (slot + 1) % SRAM_LOADER_BUFFERS) {
+        uint8_t *buffer = _loader_buf[slot];
+        size_t n = size - done < SRAM_LOADER_CHUNK ? size - done : SRAM_LOADER_CHUNK;
+        size_t offset = backward ? size - done - n : done;
+#if DEVICE_SPI_ASYNCH
+        if (pending[slot]) AsyncWait(pending[slot]);
+        while (ReadAsync(src + offset, buffer, n) == 0) yield();
+        while ((pending[slot] = WriteAsync(dst + offset, buffer, n)) == 0) yield();
+#else
+        SpiReadByteArray(src + offset, n, buffer);
+        SpiWriteByteArray(dst + offset, buffer, n);
+#endif
+        done += n;
+    }
+#if DEVICE_SPI_ASYNCH
+    AsyncFlush();
+#endif
+}
 
-    // fread returns chunk size
-    size_t bytesRead;
-    uint32_t file_size=0;
-    uint32_t address=0;
-    uint32_t file_address;
+void SRAMsimple::SramCopy(uint32_t dst, uint32_t src, size_t size)
+{
+    if (size == 0 || dst == src) return;
+    CopyChunks(dst, src, size, false);
+}
 
-    if (file == NULL) {
-        Serial.println("Failed to open file.");
-        return ;
+// Chunks run back to front when the destination overlaps the end of the
+// source, so no chunk is read after it has been overwritten
+void SRAMsimple::SramMove(uint32_t dst, uint32_t src, size_t size)
+{
+    if (size == 0 || dst == src) return;
+    CopyChunks(dst, src, size, dst > src && dst - src < size);
+}
+
+// One WRITE command streaming a block of value for as long as needed; only
+// one loader buffer's worth is ever set in MCU RAM
+void SRAMsimple::SramFill(uint32_t address, uint8_t value, size_t size)
+{
+    if (size == 0) return;
+    uint8_t *block = _loader_buf[0];
+    size_t n = size < SRAM_LOADER_CHUNK ? size : SRAM_LOADER_CHUNK;
+    BeginTransaction((uint32_t)WRITE, address, size);   // flushes queued transfers first
+    memset(block, value, n);
+    for (size_t left = size; left; left -= n) {
+        if (left < n) n = left;
+        WriteBytes(block, n);
+    }
+    EndTransaction();
+}
+
+/************ Checksums ***************************/
+static const uint32_t crc_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+uint32_t SRAMsimple::Crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    crc = ~crc;
+    while (size--) crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Reads ahead into the loader buffers with async SPI, so the CRC of one
+// chunk is computed while the next is on the bus
+uint32_t SRAMsimple::Crc(uint32_t address, size_t size)
+{
+    uint32_t crc = 0;
+    size_t chunks = (size + SRAM_LOADER_CHUNK - 1) / SRAM_LOADER_CHUNK;
+#if DEVICE_SPI_ASYNCH
+    uint32_t pending[SRAM_LOADER_BUFFERS] = {0};
+    size_t queued = 0;
+#endif
+    for (size_t i = 0; i < chunks; i++) {
+        uint8_t *buffer = _loader_buf[i % SRAM_LOADER_BUFFERS];
+        size_t n = size - i * SRAM_LOADER_CHUNK < SRAM_LOADER_CHUNK ? size - i * SRAM_LOADER_CHUNK : SRAM_LOADER_CHUNK;
+#if DEVICE_SPI_ASYNCH
+        for (; queued < chunks && queued < i + SRAM_LOADER_BUFFERS; queued++) {
+            size_t q = size - queued * SRAM_LOADER_CHUNK < SRAM_LOADER_CHUNK ? size - queued * SRAM_LOADER_CHUNK : SRAM_LOADER_CHUNK;
+            uint8_t *ahead = _loader_buf[queued % SRAM_LOADER_BUFFERS];
+            while ((pending[queued % SRAM_LOADER_BUFFERS] = ReadAsync(address + queued * SRAM_LOADER_CHUNK, ahead, q)) == 0) yield();
+        }
+        AsyncWait(pending[i % SRAM_LOADER_BUFFERS]);
+#else
+        SpiReadByteArray(address + i * SRAM_LOADER_CHUNK, n, buffer);
+#endif
+        crc = Crc32(crc, buffer, n);
+    }
+    return crc;
+}
+
+bool SRAMsimple::Verify(const SRAMRegion &region)
+{
+    return Crc(region.address, region.size) == region.crc;
+}
+
+bool SRAMsimple::VerifySample(uint32_t blocks)
+{
+    if (_crc_block == 0 || model_data.size == 0) return true;
+    uint32_t count = (model_data.size + _crc_block - 1) / _crc_block;
+    bool ok = true;
+    while (blocks--) {
+        if (_scrub_next >= count) _scrub_next = 0;
+        uint32_t offset = _scrub_next * _crc_block;
+        uint32_t n = model_data.size - offset < _crc_block ? model_data.size - offset : _crc_block;
+        scrub_stats.blocks++;
+        if (Crc(model_data.address + offset, n) != _block_crc[_scrub_next]) {
+            scrub_stats.errors++;
+            scrub_stats.bad_address = model_data.address + offset;
+            ok = false;
+        }
+        _scrub_next++;
+    }
+    return ok;
+}
+
+#if SRAM_STATS
+/************ Counters ***************************/
+SRAMStats SRAMsimple::GetStats()
+{
+    core_util_critical_section_enter();
+    SRAMStats stats = _stats;
+    core_util_critical_section_exit();
+    stats.clock_hz = SRAM_STATS_HZ;
+    return stats;
+}
+
+void SRAMsimple::ResetStats()
+{
+    core_util_critical_section_enter();
+    memset(&_stats, 0, sizeof(_stats));
+    core_util_critical_section_exit();
+}
+
+void SRAMsimple::StatsDump()
+{
+    static const char *const names[SRAM_STAT_OPS] = {"word read", "word write", "read", "write", "async read", "async write"};
+    SRAMStats stats = GetStats();
+    Serial.print("transactions ");
+    Serial.print(stats.transactions);
+    Serial.print(", mode switches ");
+    Serial.print(stats.mode_switches);
+    Serial.print(", alloc failures ");
+    Serial.println(stats.alloc_failures);
+    for (int op = 0; op < SRAM_STAT_OPS; op++) {
+        if (stats.op[op].count == 0) continue;
+        Serial.print(names[op]);
+        Serial.print(": ");
+        Serial.print(stats.op[op].count);
+        Serial.print(" ops, ");
+        Serial.print((unsigned long)stats.op[op].bytes);
+        Serial.println(" bytes, latency in ticks:");
+        for (int b = 0; b < SRAM_STAT_BUCKETS; b++) {
+            if (stats.op[op].latency[b] == 0) continue;
+            Serial.print("  < ");
+            Serial.print(2UL << b);
+            Serial.print(": ");
+            Serial.println(stats.op[op].latency[b]);
+        }
+    }
+}
+#endif
+
+#if SRAM_TRACE
+/************ Command trace ***************************/
+// A fixed ring of SRAM_TRACE_DEPTH entries; recording one is a few stores, so
+// the trace can stay on while timing the bus. Not written from interrupts.
+void SRAMsimple::Trace(uint32_t command, uint32_t length)
+{
+    SRAMTraceEntry &entry = _trace[_trace_count % SRAM_TRACE_DEPTH];
+    entry.timestamp = SRAM_TRACE_CLOCK();
+    entry.op = (uint8_t)(command >> 24);
+    entry.address = command & 0xFFFFFF;
+    entry.length = length;
+    _trace_count++;
+}
+
+size_t SRAMsimple::TraceRead(SRAMTraceEntry *out, size_t max)
+{
+    uint32_t count = _trace_count < SRAM_TRACE_DEPTH ? _trace_count : SRAM_TRACE_DEPTH;
+    if (count > max) count = max;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = _trace[(_trace_count - count + i) % SRAM_TRACE_DEPTH];
+    }
+    return count;
+}
+
+void SRAMsimple::TraceDump()
+{
+    SRAMTraceEntry entry;
+    uint32_t count = _trace_count < SRAM_TRACE_DEPTH ? _trace_count : SRAM_TRACE_DEPTH;
+    for (uint32_t i = 0; i < count; i++) {
+        entry = _trace[(_trace_count - count + i) % SRAM_TRACE_DEPTH];
+        Serial.print(entry.timestamp);
+        Serial.print(" op 0x");
+        Serial.print(entry.op, HEX);
+        Serial.print(" addr 0x");
+        Serial.print(entry.address, HEX);
+        Serial.print(" len ");
+        Serial.println(entry.length);
+    }
+}
+
+void SRAMsimple::TraceClear()
+{
+    _trace_count = 0;
+}
+#endif
+
+#if DEVICE_SPI_ASYNCH
+/************ Asynchronous transfers ***************************/
+// Requests run in order from a ring of SRAM_ASYNC_DEPTH slots. Each segment of
+// a request is two chained SPI::transfer calls (command, then payload) with CS
+// held low; the completion callback of the payload releases CS and starts the
+// next segment or the next request. Single-chip requests are one segment.
+
+uint32_t SRAMsimple::WriteAsync(uint32_t address, const uint8_t *data, size_t size, const event_callback_t &callback)
+{
+    return QueueAsync((uint32_t)WRITE, address, (uint8_t *)data, size, callback);
+}
+
+uint32_t SRAMsimple::ReadAsync(uint32_t address, uint8_t *data, size_t size, const event_callback_t &callback)
+{
+    return QueueAsync((uint32_t)READ, address, data, size, callback);
+}
+
+uint32_t SRAMsimple::QueueAsync(uint32_t op, uint32_t address, uint8_t *data, size_t size, const event_callback_t &callback)
+{
+    if (Framed()) {                               // no DMA path on QSPI or hardware NSS: run it now
+        if (op == (uint32_t)WRITE) SpiWriteByteArray(address, data, size);
+        else SpiReadByteArray(address, size, data);
+        core_util_critical_section_enter();
+        uint32_t handle = _async_issued + 1;
+        _async_issued = handle;
+        _async_completed = handle;
+        core_util_critical_section_exit();
+        if (callback) callback(SPI_EVENT_COMPLETE);
+        return handle;
+    }
+    EnsureMode(address, size);                   // a mode change waits for the queue to drain
+    if (AsyncPending() == 0) FrameBits(8);       // bus is ours, the DMA path runs on 8-bit frames
+    core_util_critical_section_enter();
+    if (_async_issued - _async_completed >= SRAM_ASYNC_DEPTH) {
+        core_util_critical_section_exit();
+        return 0;
+    }
+    if (op == (uint32_t)WRITE) Dirty(address, size);
+    uint32_t handle = _async_issued + 1;
+    AsyncRequest &req = _async[handle % SRAM_ASYNC_DEPTH];
+    req.op = op;
+    req.address = address % _size;
+    req.data = data;
+    req.size = size;
+    req.done = 0;
+    req.callback = callback;
+#if SRAM_STATS
+    req.queued = SRAM_STATS_CLOCK();
+#endif
+    SRAM_TRACE_CMD(op | req.address, size);      // issue time; the transfer may start later
+    bool idle = _async_issued == _async_completed;
+    _async_issued = handle;
+    if (idle) StartAsync();
+    core_util_critical_section_exit();
+    return handle;
+}
+
+// Starts the next segment of the oldest queued request; called with interrupts masked
+void SRAMsimple::StartAsync()
+{
+    AsyncRequest &req = _async[(_async_completed + 1) % SRAM_ASYNC_DEPTH];
+    uint32_t address = (req.address + req.done) % _size;
+    uint32_t span = Span(address);
+    _async_segment = req.size - req.done < span ? req.size - req.done : span;
+    PackCommand(_async_header, req.op | Map(address, &_async_chip));
+    Select(_async_chip);
+    _spi->transfer(_async_header, 4, (char *)NULL, 0, callback(this, &SRAMsimple::AsyncHeaderDone), SPI_EVENT_ALL);
+}
+
+void SRAMsimple::AsyncHeaderDone(int event)
+{
+    AsyncRequest &req = _async[(_async_completed + 1) % SRAM_ASYNC_DEPTH];
+    if ((event & SPI_EVENT_COMPLETE) && _async_segment > 0) {
+        if (req.op == (uint32_t)WRITE) {
+            _spi->transfer((const char *)req.data + req.done, _async_segment, (char *)NULL, 0, callback(this, &SRAMsimple::AsyncDataDone), SPI_EVENT_ALL);
+        } else {
+            _spi->transfer((const char *)NULL, 0, (char *)req.data + req.done, _async_segment, callback(this, &SRAMsimple::AsyncDataDone), SPI_EVENT_ALL);
+        }
+        return;
+    }
+    AsyncDataDone(event);
+}
+
+void SRAMsimple::AsyncDataDone(int event)
+{
+    Deselect(_async_chip);
+    uint32_t handle = _async_completed + 1;
+    AsyncRequest &req = _async[handle % SRAM_ASYNC_DEPTH];
+    req.done += _async_segment;
+    if ((event & SPI_EVENT_COMPLETE) && req.done < req.size) {
+        StartAsync();                             // the rest of the request is on another chip
+        return;
     }
+    SRAM_STATS_RECORD(req.op == (uint32_t)WRITE ? SRAM_STAT_ASYNC_WRITE : SRAM_STAT_ASYNC_READ, req.size, req.queued);
+    event_callback_t done = req.callback;
+    _async_completed = handle;
+    if (_async_issued != _async_completed) StartAsync();
+    if (done) done(event);
+}
+
+bool SRAMsimple::AsyncDone(uint32_t handle)
+{
+    return (int32_t)(_async_completed - handle) >= 0;
+}
+
+void SRAMsimple::AsyncWait(uint32_t handle)
+{
+    while (!AsyncDone(handle)) yield();
+}
+
+void SRAMsimple::AsyncFlush()
+{
+    while (_async_issued != _async_completed) yield();
+}
+
+uint32_t SRAMsimple::AsyncPending()
+{
+    return _async_issued - _async_completed;
+}
+#endif
+
+// Reads file in SD card in chunks into a buffer and writes it into the SRAM.
+// The loader cycles through SRAM_LOADER_BUFFERS static buffers: with async SPI
+// the fread of the next chunk overlaps the write of the previous one, and so
+// does the CRC of each chunk.
+alignas(4) uint8_t SRAMsimple::_loader_buf[SRAM_LOADER_BUFFERS][SRAM_LOADER_CHUNK];
+
+bool SRAMsimple::WriteFileInChunks(const char* filepath, size_t chunk_size) {
+    SRAMRegion region;
+    return WriteFilesInChunks(&filepath, &region, 1, chunk_size) == 1;
+}
+
+size_t SRAMsimple::WriteFilesInChunks(const char *const *paths, SRAMRegion *regions, size_t count, size_t chunk_size) {
     
-    while ((bytesRead = fread(buffer, 1, chunk_size, file)) > 0) {
+    if (chunk_size == 0 || chunk_size > SRAM_LOADER_CHUNK) chunk_size = SRAM_LOADER_CHUNK;
+    memset(&load_stats, 0, sizeof(load_stats));
+    uint32_t start = micros();
+    uint32_t t;
+    size_t loaded = 0;
+    int slot = 0;
+#if DEVICE_SPI_ASYNCH
+    uint32_t pending[SRAM_LOADER_BUFFERS] = {0};   // write still using each buffer
+#endif
 
-        address = SRAMMalloc(bytesRead);
+    for (size_t f = 0; f < count; f++) {
+        SRAMRegion &region = regions[f];
+        region.address = SRAM_ALLOC_FAIL;
+        region.size = 0;
+        region.crc = 0;
+        FILE *file = fopen(paths[f], "r");
 
-        if (address!= 0xFFFFFFFF){
-            if (file_size==0)
-            {
-                // Save initial file address
-                file_address = address;
-                
+        if (file == NULL) {
+            Serial.println("Failed to open file.");
+            continue;
+        }
+
+        // Allocate the whole file at once so it lands in one contiguous region
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        uint32_t length = end > 0 ? (uint32_t)end : 0;      // ftell fails with -1
+        uint32_t file_address = length > 0 ? SRAMMalloc(length) : SRAM_ALLOC_FAIL;
+        if (file_address == SRAM_ALLOC_FAIL) {
+            fclose(file);
+            Serial.println("File does not fit in SRAM.");
+            continue;
+        }
+
+        uint32_t crc = 0;
+#if SRAM_LOADER_CRC
+        _crc_block = SRAM_CRC_BLOCK;
+        while ((uint64_t)_crc_block * SRAM_CRC_BLOCKS < (uint64_t)length) _crc_block <<= 1;
+        memset(_block_crc, 0, sizeof(_block_crc));
+#else
+        _crc_block = 0;
+#endif
+        _scrub_next = 0;
+        uint32_t file_size=0;
+        
+        for (; file_size < length; slot = (slot + 1) % SRAM_LOADER_BUFFERS) {
+            uint8_t *buffer = _loader_buf[slot];
+#if DEVICE_SPI_ASYNCH
+            if (pending[slot]) {
+                t = micros();
+                AsyncWait(pending[slot]);
+                load_stats.write_wait_us += micros() - t;
+            }
+#endif
+            size_t want = length - file_size < chunk_size ? length - file_size : chunk_size;
+            t = micros();
+            size_t bytesRead = fread(buffer, 1, want, file);
+            load_stats.read_us += micros() - t;
+            if (bytesRead == 0) break;
+            // Runs while the previous chunk is still being written. The
+            // file CRC is always taken, so Verify works on every region.
+            crc = Crc32(crc, buffer, bytesRead);
+#if SRAM_LOADER_CRC
+            for (size_t done = 0; done < bytesRead; ) {
+                uint32_t offset = file_size + done;
+                size_t n = _crc_block - offset % _crc_block;
+                if (n > bytesRead - done) n = bytesRead - done;
+                _block_crc[offset / _crc_block] = Crc32(_block_crc[offset / _crc_block], buffer + done, n);
+                done += n;
             }
+#endif
+
+            t = micros();
+#if DEVICE_SPI_ASYNCH
+            while ((pending[slot] = WriteAsync(file_address + file_size, buffer, bytesRead)) == 0) yield();
+#else
+            SpiWriteByteArray(file_address + file_size, buffer, bytesRead);
+#endif
+            load_stats.write_wait_us += micros() - t;
+            file_size+=bytesRead;
+            load_stats.chunks++;
+        }
         
-        SpiWriteByteArray(address,buffer,bytesRead);
-        file_size+=bytesRead;
+        // Close the file after reading; its last writes may still be running.
+        // A short or failed read leaves a truncated copy, which is freed (once
+        // its writes are done) rather than passed off as the file.
+        bool complete = file_size == length && !ferror(file);
+        fclose(file);
+        if (!complete) {
+#if DEVICE_SPI_ASYNCH
+            AsyncFlush();
+#endif
+            SRAMFree(file_address);
+            _crc_block = 0;                 // the block CRCs are of the partial file
+            Serial.println("Failed to read file.");
+            continue;
         }
+        region.address = file_address;
+        region.size = file_size;
+        region.crc = crc;
+        model_data = region;
+        load_stats.bytes += file_size;
+        loaded++;
     }
-    
-    // Close the file after reading
-    fclose(file);
-    model_data.address = address;
-    model_data.size = file_size;
-    
-    Serial.println("File reading completed.");
-    
+#if DEVICE_SPI_ASYNCH
+    t = micros();
+    AsyncFlush();
+    load_stats.write_wait_us += micros() - t;
+#endif
+
+    load_stats.total_us = micros() - start;
+    load_stats.bytes_per_s = load_stats.total_us ? (uint32_t)((uint64_t)load_stats.bytes * 1000000 / load_stats.total_us) : 0;
+    return loaded;
+}
+
+/************ Snapshots ***************************/
+#define SRAM_SNAP_MAGIC 0x31504E53    // "SNP1"
+
+#if SRAM_HEAP_BLOCKS * 8 > SRAM_LOADER_BUFFERS * SRAM_LOADER_CHUNK
+#error "the snapshot allocation table has to fit in the loader buffers"
+#endif
+#if SRAM_LOADER_CHUNK < SRAM_SNAP_ALIGN || SRAM_SNAP_PAGE % SRAM_SNAP_ALIGN
+#error "snapshot bursts have to be whole SRAM_SNAP_ALIGN sectors"
+#endif
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t generation;                // counts the saves; incremental saves need the one they follow
+  uint32_t page;                      // SRAM_SNAP_PAGE
+  uint32_t image;                     // bytes of SRAM stored
+  uint32_t ranges;                    // entries in the allocation table
+  SRAMRegion model_data;
+  uint32_t crc_block;
+  uint32_t block_crc[SRAM_CRC_BLOCKS];
+  uint32_t crc;                       // of the fields above and the table
+};
+
+// The table has room for every heap descriptor, so the image offset is fixed
+// and an incremental save can rewrite header and table in place. Bursts are
+// whole sectors of the loader buffers.
+static const uint32_t kSnapImage = (sizeof(SnapshotHeader) + SRAM_HEAP_BLOCKS * sizeof(SRAMHeapRange) +
+                                    SRAM_SNAP_ALIGN - 1) / SRAM_SNAP_ALIGN * SRAM_SNAP_ALIGN;
+static const uint32_t kSnapBurst = SRAM_LOADER_CHUNK / SRAM_SNAP_ALIGN * SRAM_SNAP_ALIGN;
+
+static uint32_t SnapshotCrc(const SnapshotHeader &header, const SRAMHeapRange *table)
+{
+    uint32_t crc = SRAMsimple::Crc32(0, (const uint8_t *)&header, offsetof(SnapshotHeader, crc));
+    return SRAMsimple::Crc32(crc, (const uint8_t *)table, header.ranges * sizeof(SRAMHeapRange));
 }
 
+// Marks the snapshot pages a write touches; a few instructions per call
+void SRAMsimple::Dirty(uint32_t address, size_t size)
+{
+    if (size == 0) return;
+    uint32_t pages = _size / SRAM_SNAP_PAGE;
+    address %= _size;
+    uint32_t first = address / SRAM_SNAP_PAGE;
+    uint32_t count = (address % SRAM_SNAP_PAGE + size + SRAM_SNAP_PAGE - 1) / SRAM_SNAP_PAGE;
+    if (count > pages) count = pages;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page = (first + i) % pages;
+        _snap_dirty[page / 32] |= 1u << (page % 32);
+    }
+}
 
-// void SRAMsimple::ReadByteArray(uint32_t address, byte *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<big; i++){
-//     data[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// /*********** Write and Read an Integer (2 bytes) ************************/
-// void SRAMsimple::WriteInt(uint32_t address, int data){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[2]; 				  // temporary array of bytes with 2 elements
-//   temp[0]=(byte)(data>>8);                        // high byte of integer
-//   temp[1]=(byte)(data);                           // low byte of integer
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, 2);                          // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// int SRAMsimple::ReadInt(uint32_t address){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[2]; 				  // temporary array of bytes with 2 elements
-//   int data=0;
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<2; i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   data=((int)temp[0]<<8)+temp[1];                      // data=high byte & low byte
-//   return data;
-// }
-
-// /*********** Write and Read an Integer Array ************************/
-// void SRAMsimple::WriteIntArray(uint32_t address, int *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*2]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   for(uint16_t i=0; i<big; i++){                   // take apart integers into high and low bytes
-//     temp[j]=(byte)(data[i]>>8);                   // high byte of integer
-//     temp[j+1]=(byte)(data[i]);                    // low byte of integer
-//     j+=2;                                         // increment counter
-//   }
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, big*2);                      // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// void SRAMsimple::ReadIntArray(uint32_t address, int *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*2]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<(big*2); i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   for(uint16_t i=0; i<big; i++){
-//     data[i]=((int)temp[j]<<8)+temp[j+1];          // data=high byte & low byte
-//     j+=2;                                         // increment counter
-//   }
-// }
-
-// /*********** Write and Read an Unsigned Integer (2 bytes) ************************/
-// void SRAMsimple::WriteUnsignedInt(uint32_t address, unsigned int data){ 
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[2]; 				  // temporary array of bytes with 2 elements
-//   temp[0]=(byte)(data>>8);                        // high byte of integer
-//   temp[1]=(byte)(data);                           // low byte of integer
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, 2);                          // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// unsigned int SRAMsimple::ReadUnsignedInt(uint32_t address){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[2]; 				  // temporary array of bytes with 2 elements
-//   unsigned int data=0;
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<2; i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   data=(temp[0]<<8)+temp[1];                      // data=high byte & low byte
-//   return data;
-// }
-
-// /*********** Write and Read an Unsigned Integer Array ************************/
-// void SRAMsimple::WriteUnsignedIntArray(uint32_t address, unsigned int *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*2]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   for(uint16_t i=0; i<big; i++){                   // take apart integers into high and low bytes
-//     temp[j]=(byte)(data[i]>>8);                   // high byte of integer
-//     temp[j+1]=(byte)(data[i]);                    // low byte of integer
-//     j+=2;                                         // increment counter
-//   }
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, big*2);                      // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// void SRAMsimple::ReadUnsignedIntArray(uint32_t address, unsigned int *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*2]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<(big*2); i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   for(uint16_t i=0; i<big; i++){
-//     data[i]=((int)temp[j]<<8)+temp[j+1];          // data=high byte & low byte
-//     j+=2;                                         // increment counter
-//   }
-// }
-
-// /*********** Write and Read a Long (4 bytes) ************************/
-// void SRAMsimple::WriteLong(uint32_t address, long data){  
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[4]; 				  // temporary array of bytes with 4 elements
-//   temp[0]=(byte)(data >> 24);                     // high byte of integer
-//   temp[1]=(byte)(data >> 16);                     // low byte of integer
-//   temp[2]=(byte)(data >> 8);                      // low byte of integer
-//   temp[3]=(byte)(data);                           // low byte of integer
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, 4);                          // transfer an array of data => needs array name & size (4 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// long SRAMsimple::ReadLong(uint32_t address){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[4]; 				  // temporary array of bytes with 4 elements
-//   long data=0;
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<4; i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   data=((long)temp[0]<<24)+((long)temp[1]<<16)+((long)temp[2]<<8)+temp[3];   // reassemble bytes into long
-//   return data;
-// }
-
-// /*********** Write and Read a Long Array ************************/
-// void SRAMsimple::WriteLongArray(uint32_t address, long *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*4]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   for(uint16_t i=0; i<big; i++){                  // take apart integers into high and low bytes
-//     temp[j]=(byte)(data[i] >> 24);                // high byte of integer
-//     temp[j+1]=(byte)(data[i] >> 16);              // low byte of integer
-//     temp[j+2]=(byte)(data[i] >> 8);               // low byte of integer
-//     temp[j+3]=(byte)data[i];                      // low byte of integer
-//     j+=4;                                         // increment counter
-//   }
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, big*4);                      // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// void SRAMsimple::ReadLongArray(uint32_t address, long *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*4]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<(big*4); i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   for(uint16_t i=0; i<big; i++){
-//     data[i]=((long)temp[j]<<24)+((long)temp[j+1]<<16)+((long)temp[j+2]<<8)+temp[j+3];  // put together 4 bytes
-//     j+=4;                                         // increment counter
-//   }
-// }
-
-// /*********** Write and Read an Unsigned Long (4 bytes) ************************/
-// void SRAMsimple::WriteUnsignedLong(uint32_t address, unsigned long data){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[4]; 			 	  // temporary array of bytes with 4 elements
-//   temp[0]=(byte)(data >> 24);                     // high byte of integer
-//   temp[1]=(byte)(data >> 16);                     // low byte of integer
-//   temp[2]=(byte)(data >> 8);                      // low byte of integer
-//   temp[3]=(byte)(data);                           // low byte of integer
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, 4);                          // transfer an array of data => needs array name & size (4 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// unsigned long SRAMsimple::ReadUnsignedLong(uint32_t address){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[4]; 				  // temporary array of bytes with 4 elements
-//   unsigned long data=0;
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<4; i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   data=((long)temp[0]<<24)+((long)temp[1]<<16)+((long)temp[2]<<8)+temp[3];   // reassemble bytes into long
-//   return data;
-// }
-
-// /*********** Write and Read a Long Array ************************/
-// void SRAMsimple::WriteUnsignedLongArray(uint32_t address, unsigned long *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*4]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   for(uint16_t i=0; i<big; i++){                  // take apart integers into high and low bytes
-//     temp[j]=(byte)(data[i] >> 24);                // high byte of integer
-//     temp[j+1]=(byte)(data[i] >> 16);              // low byte of integer
-//     temp[j+2]=(byte)(data[i] >> 8);               // low byte of integer
-//     temp[j+3]=(byte)data[i];                      // low byte of integer
-//     j+=4;                                         // increment counter
-//   }
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, big*4);                      // transfer an array of data => needs array name & size (2 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// void SRAMsimple::ReadUnsignedLongArray(uint32_t address, unsigned long *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[big*4]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;                                   // byte counter
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<(big*4); i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   for(uint16_t i=0; i<big; i++){
-//     data[i]=((long)temp[j]<<24)+((long)temp[j+1]<<16)+((long)temp[j+2]<<8)+temp[j+3];  // put together 4 bytes
-//     j+=4;                                         // increment counter
-//   }
-// }
-
-// /*********** Write and Read a Float (4 bytes) ************************/
-// void SRAMsimple::WriteFloat(uint32_t address, float data){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte *temp=(byte *)&data;                       // split float into 4 bytes
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(temp, 4);                          // transfer an array of data => needs array name & size (4 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// float SRAMsimple::ReadFloat(uint32_t address){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte temp[4]; 				  // temporary array of bytes with 4 elements
-//   float data=0;
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<4; i++){
-//     temp[i] = _spi.write(0x00);                 // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   data = *(float *)&temp;                         // 4 bytes to a float.
-//   return data;                                    // https://www.microchip.com/forums/m590535.aspx
-// }
-
-// /*********** Write and Read a Float Array ************************/
-// void SRAMsimple::WriteFloatArray(uint32_t address, float *data, uint16_t big){
-//   byte holder[big*4]; 				  // temporary array of bytes with 2 elements
-//   uint16_t j=0;
-//   for(int i=0;i<big;i++){
-//     byte *temp=(byte *)&data[i];                  // split float into 4 bytes
-//     holder[j]=temp[0];
-//     holder[j+1]=temp[1];
-//     holder[j+2]=temp[2];
-//     holder[j+3]=temp[3];
-//     j+=4;
-//   }
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(WRITE);                            // send WRITE command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   _spi.write(holder, big*4);                    // transfer an array of data => needs array name & size (4 elements)
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-// }
-
-// void SRAMsimple::ReadFloatArray(uint32_t address, float *data, uint16_t big){
-//   SetMode(CS,Sequential);                         // set to send/receive multiple bytes of data
-//   byte holder[big*4]; 				  // temporary array of bytes
-//   byte t[4];                                      // to hold 4 bytes
-//   digitalWrite(CS, LOW);                          // start new command sequence
-//   _spi.write(READ);                             // send READ command
-//   _spi.write((byte)(address >> 16));            // send high byte of address
-//   _spi.write((byte)(address >> 8));             // send middle byte of address
-//   _spi.write((byte)address);                    // send low byte of address
-//   for(uint16_t i=0; i<(big*4); i++){
-//     holder[i] = _spi.write(0x00);               // read the data byte
-//   }
-//   digitalWrite(CS, HIGH);                         // set SPI slave select HIGH
-//   uint16_t j=0;
-//   for(int i=0;i<big;i++){ 
-//     t[0]=holder[j];
-//     t[1]=holder[j+1];
-//     t[2]=holder[j+2];
-//     t[3]=holder[j+3];
-//     data[i] = *(float *)&t;                        // 4 bytes to a float.
-//     j+=4;
-//   }
-// }
+// Streams size bytes of SRAM to the current file position. With async SPI the
+// next burst is read while the SD card takes this one.
+bool SRAMsimple::SnapshotOut(FILE *file, uint32_t address, uint32_t size)
+{
+    size_t bursts = (size + kSnapBurst - 1) / kSnapBurst;
+    uint32_t t;
+#if DEVICE_SPI_ASYNCH
+    uint32_t pending[SRAM_LOADER_BUFFERS] = {0};
+    size_t queued = 0;
+#endif
+    for (size_t i = 0; i < bursts; i++) {
+        uint8_t *buffer = _loader_buf[i % SRAM_LOADER_BUFFERS];
+        size_t n = size - i * kSnapBurst < kSnapBurst ? size - i * kSnapBurst : kSnapBurst;
+        t = micros();
+#if DEVICE_SPI_ASYNCH
+        for (; queued < bursts && queued < i + SRAM_LOADER_BUFFERS; queued++) {
+            size_t q = size - queued * kSnapBurst < kSnapBurst ? size - queued * kSnapBurst : kSnapBurst;
+            uint8_t *ahead = _loader_buf[queued % SRAM_LOADER_BUFFERS];
+            while ((pending[queued % SRAM_LOADER_BUFFERS] = ReadAsync(address + queued * kSnapBurst, ahead, q)) == 0) yield();
+        }
+        AsyncWait(pending[i % SRAM_LOADER_BUFFERS]);
+#else
+        SpiReadByteArray(address + i * kSnapBurst, n, buffer);
+#endif
+        snapshot_stats.spi_wait_us += micros() - t;
+        t = micros();
+        size_t written = fwrite(buffer, 1, n, file);
+        snapshot_stats.sd_us += micros() - t;
+        if (written != n) return false;
+        snapshot_stats.bytes += n;
+        snapshot_stats.bursts++;
+    }
+    return true;
+}
+
+bool SRAMsimple::SaveSnapshot(const char *path, bool incremental)
+{
+    memset(&snapshot_stats, 0, sizeof(snapshot_stats));
+    uint32_t start = micros();
+#if DEVICE_SPI_ASYNCH
+    AsyncFlush();                       // queued writes land before the image is read
+#endif
+    SnapshotHeader header;
+    uint32_t image = (_heap.HighWater() + SRAM_SNAP_PAGE - 1) / SRAM_SNAP_PAGE * SRAM_SNAP_PAGE;
+    uint32_t stored = 0;                // image bytes the file already holds
+    FILE *file = NULL;
+    if (incremental && _snap_generation) {
+        file = fopen(path, "r+b");
+        if (file && (fread(&header, sizeof(header), 1, file) != 1 || header.magic != SRAM_SNAP_MAGIC ||
+                     header.generation != _snap_generation || header.page != SRAM_SNAP_PAGE)) {
+            fclose(file);
+            file = NULL;
+        }
+        if (file) stored = header.image;
+    }
+    bool full = file == NULL;
+    if (full) file = fopen(path, "wb");
+    if (file == NULL) {
+        Serial.println("Failed to open snapshot file.");
+        return false;
+    }
+
+    // The header goes in last; until then the file does not pass as a snapshot
+    uint32_t t = micros();
+    bool ok = fseek(file, 0, SEEK_SET) == 0;
+    if (full) {
+        memset(_loader_buf, 0, sizeof(_loader_buf));
+        for (uint32_t done = 0; ok && done < kSnapImage; done += SRAM_LOADER_CHUNK) {
+            size_t n = kSnapImage - done < SRAM_LOADER_CHUNK ? kSnapImage - done : SRAM_LOADER_CHUNK;
+            ok = fwrite(_loader_buf[0], 1, n, file) == n;
+        }
+    } else {
+        uint32_t magic = 0;
+        ok = ok && fwrite(&magic, sizeof(magic), 1, file) == 1;
+    }
+    snapshot_stats.sd_us += micros() - t;
+
+    // Runs of pages to write, each one sequential burst stream
+    uint32_t pages = image / SRAM_SNAP_PAGE;
+    for (uint32_t p = 0; ok && p < pages; ) {
+        uint32_t q = p;
+        while (q < pages && (full || q * SRAM_SNAP_PAGE >= stored || (_snap_dirty[q / 32] >> (q % 32) & 1))) q++;
+        if (q == p) {
+            p++;
+            continue;
+        }
+        ok = fseek(file, kSnapImage + p * SRAM_SNAP_PAGE, SEEK_SET) == 0 &&
+             SnapshotOut(file, p * SRAM_SNAP_PAGE, (q - p) * SRAM_SNAP_PAGE);
+        p = q;
+    }
+#if DEVICE_SPI_ASYNCH
+    AsyncFlush();                       // an early stop can leave reads into the loader buffers
+#endif
+
+    SRAMHeapRange *table = (SRAMHeapRange *)_loader_buf;
+    header.magic = SRAM_SNAP_MAGIC;
+    header.generation = _snap_generation + 1;
+    header.page = SRAM_SNAP_PAGE;
+    header.image = image;
+    header.ranges = _heap.Allocations(table, SRAM_HEAP_BLOCKS);
+    header.model_data = model_data;
+    header.crc_block = _crc_block;
+    memcpy(header.block_crc, _block_crc, sizeof(header.block_crc));
+    header.crc = SnapshotCrc(header, table);
+    t = micros();
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(table, sizeof(SRAMHeapRange), header.ranges, file) == header.ranges;
+    ok = fclose(file) == 0 && ok;
+    snapshot_stats.sd_us += micros() - t;
+
+    _snap_generation = ok ? header.generation : 0;      // after a failure the file is unknown
+    if (ok) memset(_snap_dirty, 0, sizeof(_snap_dirty));
+    snapshot_stats.total_us = micros() - start;
+    snapshot_stats.bytes_per_s = snapshot_stats.total_us ? (uint32_t)((uint64_t)snapshot_stats.bytes * 1000000 / snapshot_stats.total_us) : 0;
+    if (!ok) Serial.println("Failed to write snapshot.");
+    return ok;
+}
+
+// The table is checked before the heap is touched. The image then streams
+// back like a file load: fread of the next burst while the last one is written.
+bool SRAMsimple::LoadSnapshot(const char *path)
+{
+    memset(&snapshot_stats, 0, sizeof(snapshot_stats));
+    uint32_t start = micros();
+    uint32_t t;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        Serial.println("Failed to open snapshot file.");
+        return false;
+    }
+#if DEVICE_SPI_ASYNCH
+    AsyncFlush();                       // the loader buffers are reused below
+#endif
+    SnapshotHeader header;
+    SRAMHeapRange *table = (SRAMHeapRange *)_loader_buf;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == SRAM_SNAP_MAGIC &&
+              header.page == SRAM_SNAP_PAGE && header.image <= _size && header.ranges <= SRAM_HEAP_BLOCKS &&
+              fread(table, sizeof(SRAMHeapRange), header.ranges, file) == header.ranges &&
+              SnapshotCrc(header, table) == header.crc;
+    if (!ok) {
+        fclose(file);
+        Serial.println("Not a valid snapshot.");
+        return false;
+    }
+
+    _heap.Begin(0, _size);
+    for (uint32_t i = 0; ok && i < header.ranges; i++) {
+        ok = _heap.Claim(table[i].address, table[i].size) != SRAM_ALLOC_FAIL;
+    }
+    ok = ok && fseek(file, kSnapImage, SEEK_SET) == 0;
+    int slot = 0;
+#if DEVICE_SPI_ASYNCH
+    uint32_t pending[SRAM_LOADER_BUFFERS] = {0};
+#endif
+    for (uint32_t done = 0; ok && done < header.image; slot = (slot + 1) % SRAM_LOADER_BUFFERS) {
+        uint8_t *buffer = _loader_buf[slot];
+#if DEVICE_SPI_ASYNCH
+        if (pending[slot]) {
+            t = micros();
+            AsyncWait(pending[slot]);
+            snapshot_stats.spi_wait_us += micros() - t;
+        }
+#endif
+        size_t n = header.image - done < kSnapBurst ? header.image - done : kSnapBurst;
+        t = micros();
+        ok = fread(buffer, 1, n, file) == n;
+        snapshot_stats.sd_us += micros() - t;
+        if (!ok) break;
+        t = micros();
+#if DEVICE_SPI_ASYNCH
+        while ((pending[slot] = WriteAsync(done, buffer, n)) == 0) yield();
+#else
+        SpiWriteByteArray(done, buffer, n);
+#endif
+        snapshot_stats.spi_wait_us += micros() - t;
+        done += n;
+        snapshot_stats.bytes += n;
+        snapshot_stats.bursts++;
+    }
+#if DEVICE_SPI_ASYNCH
+    t = micros();
+    AsyncFlush();
+    snapshot_stats.spi_wait_us += micros() - t;
+#endif
+    fclose(file);
+
+    if (ok) {
+        model_data = header.model_data;
+        _crc_block = header.crc_block;
+        memcpy(_block_crc, header.block_crc, sizeof(_block_crc));
+        _snap_generation = header.generation;
+    } else {                            // nothing in SRAM can be trusted now
+        _heap.Begin(0, _size);
+        memset(&model_data, 0, sizeof(model_data));
+        _crc_block = 0;
+        _snap_generation = 0;
+    }
+    _scrub_next = 0;
+    memset(_snap_dirty, 0, sizeof(_snap_dirty));       // SRAM and file agree again
+    snapshot_stats.total_us = micros() - start;
+    snapshot_stats.bytes_per_s = snapshot_stats.total_us ? (uint32_t)((uint64_t)snapshot_stats.bytes * 1000000 / snapshot_stats.total_us) : 0;
+    if (!ok) Serial.println("Snapshot image incomplete.");
+    return ok;
+}
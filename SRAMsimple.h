@@ -9,6 +9,10 @@
 
 #include <Arduino.h>
 #include "mbed.h"
+#include "SRAMheap.h"
+#if !defined(SRAM_STATS_CLOCK) && !defined(DWT)
+#include <chrono>                      // the SRAM_STATS_CLOCK fallback
+#endif
 
 
 /************SRAM opcodes: commands for the 23AA04M SRAM memory chip ******************/
@@ -17,55 +21,472 @@
 #define READ        0x03000000 
 #define HSREAD      0x0B000000 // High Speed Read
 #define WRITE       0x02000000
+#define EQIO        0x38000000 // Enter SQI (quad) mode
+#define RSTIO       0xFF000000 // Reset to SPI mode
 #define Sequential  0x00401400  // Sequential mode (read/write blocks of memory)
 #define ByteMode    0x00001400    // Byte mode (read/write one byte at a time)
 #define PageMode    0x00801400 // Page Mode
 
-extern byte CS;		    // Global variable for CS pin (default 10)
+#define SRAM_SIZE   0x80000    // 23AA04M capacity: 4 Mbit = 512 KB
+#define SRAM_PAGE_SIZE 32      // page mode wraps within this many bytes
+#define SRAM_MODE_UNKNOWN 0xFF // mode cache before a successful RDSR
+
+#ifndef SRAM_SQI_READ_DUMMY
+#define SRAM_SQI_READ_DUMMY 2  // clocks between address and data of a READ in SQI mode
+#endif
+
+#ifndef SRAM_MAX_CHIPS
+#define SRAM_MAX_CHIPS 4       // chips one SRAMsimple can drive
+#endif
+#ifndef SRAM_STRIPE_SIZE
+#define SRAM_STRIPE_SIZE 32    // bytes per stripe with SRAM_STRIPE; 32 = one page
+#endif
+
+// Address layouts for several chips on one bus
+#define SRAM_CONCAT 0          // chip 0 holds the first SRAM_SIZE bytes, then chip 1, ...
+#define SRAM_STRIPE 1          // consecutive stripes rotate across the chips; one bus, so no faster
+
+#ifndef SRAM_GATHER_GAP
+#define SRAM_GATHER_GAP 16     // ReadV reads through gaps up to this size rather than start a new command
+#endif
+#ifndef SRAM_GATHER_BUFFER
+#define SRAM_GATHER_BUFFER 128 // stack buffer ReadV/WriteV pack small ranges into
+#endif
+
+#ifndef SRAM_LOADER_BUFFERS
+#define SRAM_LOADER_BUFFERS 2  // WriteFileInChunks buffers in flight
+#endif
+#ifndef SRAM_LOADER_CHUNK
+#define SRAM_LOADER_CHUNK 3200 // size of each loader buffer, the largest chunk_size
+#endif
+
+// Checksums of loaded files: a CRC-32 of the whole file in model_data and one
+// per block for VerifySample. Blocks are SRAM_CRC_BLOCK bytes, doubled until
+// SRAM_CRC_BLOCKS of them cover the file.
+#ifndef SRAM_LOADER_CRC
+#define SRAM_LOADER_CRC 1      // 0 skips the block CRCs; VerifySample then has nothing to check
+#endif
+#ifndef SRAM_CRC_BLOCK
+#define SRAM_CRC_BLOCK 4096
+#endif
+#ifndef SRAM_CRC_BLOCKS
+#define SRAM_CRC_BLOCKS 64     // block CRCs kept in MCU RAM
+#endif
+
+// Snapshots on the SD card: a header, a table of the heap's allocations and
+// the SRAM image from address 0 up to the heap's high-water mark, starting on
+// a SRAM_SNAP_ALIGN boundary. Incremental saves rewrite only the
+// SRAM_SNAP_PAGE pages written since the last save or load.
+#ifndef SRAM_SNAP_PAGE
+#define SRAM_SNAP_PAGE 4096    // dirty tracking granularity, a multiple of SRAM_SNAP_ALIGN
+#endif
+#ifndef SRAM_SNAP_ALIGN
+#define SRAM_SNAP_ALIGN 512    // SD sector; the image and every burst of it start on one
+#endif
+#define SRAM_SNAP_PAGES (SRAM_MAX_CHIPS * SRAM_SIZE / SRAM_SNAP_PAGE)
+
+#ifndef SRAM_ASYNC_DEPTH
+#define SRAM_ASYNC_DEPTH 8     // WriteAsync/ReadAsync requests that can be outstanding
+#endif
+
+// Chip-select backends, chosen at construction. Each transaction drives CS
+// twice, so on short commands the backend is a good part of the cost.
+#define SRAM_CS_DIGITALWRITE 0 // Arduino digitalWrite: pin lookup on every edge
+#define SRAM_CS_DIGITALOUT 1   // an mbed DigitalOut per chip
+#define SRAM_CS_GPIO 2         // stores to the port's BSRR (gpio_write off STM32)
+#define SRAM_CS_HARDWARE 3     // NSS of the SPI peripheral, the ssel given to SPI; one chip
+#ifndef SRAM_CS_DEFAULT
+#define SRAM_CS_DEFAULT SRAM_CS_GPIO
+#endif
+#ifndef SRAM_CS_PIN
+#define SRAM_CS_PIN PI_0       // CS of the single-chip constructors
+#endif
+#ifndef SRAM_NSS_STAGE
+#define SRAM_NSS_STAGE 64      // with SRAM_CS_HARDWARE, largest command (header and data) sent per call
+#endif
+
+// Trace level: 0 compiles tracing out, 1 records every command in a binary
+// ring in MCU RAM, 2 also prints each WriteWord/ReadWord on Serial
+#ifndef SRAM_TRACE
+#define SRAM_TRACE 0
+#endif
+#ifndef SRAM_TRACE_DEPTH
+#define SRAM_TRACE_DEPTH 64    // ring entries, a power of two
+#endif
+#ifndef SRAM_TRACE_CLOCK
+#if defined(DWT)
+#define SRAM_TRACE_CLOCK() (SRAMsimple::cycle_counter ? DWT->CYCCNT : micros())   // Cortex-M cycle counter
+#else
+#define SRAM_TRACE_CLOCK() micros()
+#endif
+#endif
+
+// Counters and latency histograms, kept in MCU RAM: a couple of clock reads
+// and increments per operation, so they can stay on. 0 compiles them out.
+#ifndef SRAM_STATS
+#define SRAM_STATS 1
+#endif
+#ifndef SRAM_STATS_CLOCK
+#if defined(DWT)
+// The Cortex-M cycle counter, or us_ticker when Init found it stopped
+#define SRAM_STATS_CLOCK() (SRAMsimple::cycle_counter ? DWT->CYCCNT : us_ticker_read())
+#define SRAM_STATS_HZ (SRAMsimple::cycle_counter ? SystemCoreClock : 1000000u)
+#else
+#define SRAM_STATS_CLOCK() ((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>( \
+                            std::chrono::steady_clock::now().time_since_epoch()).count())
+#define SRAM_STATS_HZ 1000000000u
+#endif
+#endif
+#ifndef SRAM_STATS_HZ
+#define SRAM_STATS_HZ 1000000u // with an SRAM_STATS_CLOCK of your own, define its rate too
+#endif
+
+// Operations with their own counters. Word commands that go through the
+// block path (SQI, hardware NSS, a word across two chips) count as blocks,
+// and so do async requests on those transports.
+#define SRAM_STAT_WORD_READ 0  // ReadWord
+#define SRAM_STAT_WORD_WRITE 1 // WriteWord
+#define SRAM_STAT_READ 2       // one streaming read, BeginRead to EndTransaction
+#define SRAM_STAT_WRITE 3      // one streaming write
+#define SRAM_STAT_ASYNC_READ 4 // ReadAsync, queued to completed
+#define SRAM_STAT_ASYNC_WRITE 5
+#define SRAM_STAT_OPS 6
+#define SRAM_STAT_BUCKETS 32   // bucket b: latencies of 2^b to 2^(b+1)-1 clock ticks (0 and 1 in bucket 0)
 
 using namespace mbed;
 
+// Location of the last file loaded by WriteFileInChunks
+struct SRAMRegion {
+  uint32_t address;
+  uint32_t size;
+  uint32_t crc;                       // CRC-32 of the contents, 0 when not computed
+};
+
+// Background checking of the last loaded file, block by block
+struct SRAMScrubStats {
+  uint32_t blocks;                    // blocks checked
+  uint32_t errors;                    // blocks whose CRC did not match
+  uint32_t bad_address;               // start of the last mismatching block
+};
+
+// Throughput of the last WriteFileInChunks call; the loader prints nothing
+struct SRAMLoadStats {
+  uint32_t bytes;
+  uint32_t chunks;
+  uint32_t total_us;
+  uint32_t read_us;                   // in fread, the SD stage
+  uint32_t write_wait_us;             // blocked on the SPI stage
+  uint32_t bytes_per_s;
+};
+
+// Throughput of the last SaveSnapshot or LoadSnapshot call
+struct SRAMSnapshotStats {
+  uint32_t bytes;                     // image bytes moved
+  uint32_t bursts;                    // SD reads or writes of the image
+  uint32_t total_us;
+  uint32_t sd_us;                     // in fread/fwrite
+  uint32_t spi_wait_us;               // blocked on the SPI stage
+  uint32_t bytes_per_s;
+};
 
+struct SRAMOpStats {
+  uint32_t count;
+  uint64_t bytes;
+  uint32_t latency[SRAM_STAT_BUCKETS];   // log2 histogram, in SRAM_STATS_CLOCK ticks
+};
+
+// Everything counted since construction or the last ResetStats
+struct SRAMStats {
+  SRAMOpStats op[SRAM_STAT_OPS];      // indexed by SRAM_STAT_*
+  uint32_t transactions;              // commands on the bus: CS assertions, or calls where the peripheral frames them
+  uint32_t mode_switches;             // WRSR commands sent
+  uint32_t alloc_failures;            // SRAMMalloc calls that returned SRAM_ALLOC_FAIL
+  uint32_t clock_hz;                  // ticks per second of the histograms
+};
+
+// One range of a ReadV/WriteV batch
+struct SRAMIoVec {
+  uint32_t address;
+  uint8_t *data;
+  size_t size;
+};
+
+// One SPI command. op is the instruction byte (WRITE, READ, HSREAD, WRSR, ...);
+// for WRSR the address field holds the status value.
+struct SRAMTraceEntry {
+  uint32_t timestamp;                 // SRAM_TRACE_CLOCK() when the command was issued
+  uint32_t address;
+  uint32_t length;                    // data bytes moved
+  uint8_t op;
+};
 
 class SRAMsimple {
+  friend class SRAMreader;            // chains its prefetch transfers on _spi
+  friend class SRAMtransaction;
   private:
-  uint8_t cs;
-  
-  SPI& _spi;
+  uint32_t _cs[SRAM_MAX_CHIPS];       // chip select pin of each chip
+  uint8_t _chips;
+  uint8_t _cs_mode;                   // SRAM_CS_*
+  DigitalOut *_cs_out[SRAM_MAX_CHIPS];   // SRAM_CS_DIGITALOUT
+  gpio_t _cs_gpio[SRAM_MAX_CHIPS];    // SRAM_CS_GPIO
+  void InitSelect(uint8_t cs_mode);
+  inline void Select(uint8_t chip);
+  inline void Deselect(uint8_t chip);
+  // Holds a chip selected for its lifetime, so every exit ends the command
+  class ChipSelect {
+    public:
+      ChipSelect(SRAMsimple &sram, uint8_t chip) : _sram(sram), _chip(chip) { _sram.Select(chip); }
+      ~ChipSelect() { _sram.Deselect(_chip); }
+    private:
+      SRAMsimple &_sram;
+      uint8_t _chip;
+  };
+  // The peripheral frames every call with hardware NSS, as it does in SQI, so
+  // each SPI call has to carry a whole command
+  bool Framed();
+  uint8_t _nss_stage[SRAM_NSS_STAGE];
+  void FramedTransfer(uint32_t op, uint32_t address, const uint8_t *tx, uint8_t *rx, size_t size);
+  uint8_t _layout;                    // SRAM_CONCAT or SRAM_STRIPE
+  uint32_t _size;                     // combined capacity
+  uint32_t Map(uint32_t address, uint8_t *chip);
+  uint32_t Span(uint32_t address);
+
+  SPI *_spi;                          // NULL when the chip runs in SQI mode
+#if DEVICE_QSPI
+  QSPI *_qspi;                        // SQI transport, NULL on SPI
+  int _qspi_dummy;                    // dummy cycles currently configured
+  void QuadFormat(int dummy);
+  void QuadTransfer(uint32_t op, uint32_t address, const uint8_t *tx, uint8_t *rx, size_t size);
+#endif
+  bool Quad();
+  uint8_t _mode;                      // status register mode bits of every chip, or SRAM_MODE_UNKNOWN
+  void EnsureMode(uint32_t address, size_t size);
   static SRAMsimple * _inst;
+  SRAMheap _heap;                     // backs SRAMMalloc/SRAMFree
+  int _frame_bits;                    // SPI frame width currently programmed
+  void FrameBits(int bits);
+  static void PackCommand(char *out, uint32_t command);
+  void Init();
+  // Open streaming transaction; it moves to the next chip at segment ends
+  uint32_t _stream_op;                // WRITE, READ or HSREAD
+  uint32_t _stream_address;           // linear address of the next byte
+  uint32_t _stream_left;              // bytes before the current segment ends
+  uint8_t _stream_chip;
+  void BeginTransaction(uint32_t op, uint32_t address, size_t size);
+  void OpenSegment();
+  void NextSegment();
+  static void SortIoVec(SRAMIoVec *vec, size_t count);
+  void CopyChunks(uint32_t dst, uint32_t src, size_t size, bool backward);
+  alignas(4) static uint8_t _loader_buf[SRAM_LOADER_BUFFERS][SRAM_LOADER_CHUNK];
+  uint32_t _block_crc[SRAM_CRC_BLOCKS];   // of model_data
+  uint32_t _crc_block;                // bytes per block, 0 with no block CRCs
+  uint32_t _scrub_next;               // block VerifySample checks next
+  uint32_t _snap_dirty[(SRAM_SNAP_PAGES + 31) / 32];   // pages written since the last snapshot
+  uint32_t _snap_generation;          // of the snapshot last saved or loaded, 0 for none
+  void Dirty(uint32_t address, size_t size);
+  bool SnapshotOut(FILE *file, uint32_t address, uint32_t size);
+
+#if SRAM_TRACE
+  SRAMTraceEntry _trace[SRAM_TRACE_DEPTH];
+  static_assert((SRAM_TRACE_DEPTH & (SRAM_TRACE_DEPTH - 1)) == 0,
+                "SRAM_TRACE_DEPTH must be a power of two: the ring is indexed by a wrapping counter");
+  uint32_t _trace_count;              // entries ever written
+  void Trace(uint32_t command, uint32_t length);
+#endif
+
+#if SRAM_STATS
+  SRAMStats _stats;
+  uint32_t _stream_start;             // clock when the streaming command went out
+  uint32_t _stream_bytes;
+  inline void Record(uint8_t op, uint32_t bytes, uint32_t start);
+#endif
+
+#if DEVICE_SPI_ASYNCH
+  struct AsyncRequest {
+    uint32_t op;                      // WRITE or READ
+    uint32_t address;
+    uint8_t *data;
+    size_t size;
+    size_t done;                      // bytes of finished segments
+    event_callback_t callback;
+#if SRAM_STATS
+    uint32_t queued;                  // clock when it was queued
+#endif
+  };
+  AsyncRequest _async[SRAM_ASYNC_DEPTH];
+  char _async_header[4];
+  size_t _async_segment;              // bytes in the segment on the bus
+  uint8_t _async_chip;
+  volatile uint32_t _async_issued;    // handle of the last queued request
+  volatile uint32_t _async_completed; // handle of the last finished request
+  uint32_t QueueAsync(uint32_t op, uint32_t address, uint8_t *data, size_t size, const event_callback_t &callback);
+  void StartAsync();
+  void AsyncHeaderDone(int event);
+  void AsyncDataDone(int event);
+#endif
   
   public:
-    SRAMsimple( SPI& spi_param);
+    SRAMRegion model_data;
+    SRAMLoadStats load_stats;
+    SRAMScrubStats scrub_stats;
+    SRAMSnapshotStats snapshot_stats;
+    static bool cycle_counter;        // DWT->CYCCNT runs; set by Init, read by the trace and stats clocks
+    // cs_mode is one of SRAM_CS_*. With SRAM_CS_HARDWARE the SPI object is
+    // built with the chip's CS as ssel, and every command goes out as one call.
+    SRAMsimple( SPI& spi_param, uint8_t cs_mode = SRAM_CS_DEFAULT);
+    // Several chips on one bus, seen as one address space of chips * SRAM_SIZE bytes.
+    // Hardware NSS can only select one of them, so it falls back to SRAM_CS_GPIO.
+    SRAMsimple(SPI& spi_param, const uint32_t *cs_pins, uint8_t chips, uint8_t layout = SRAM_CONCAT,
+               uint8_t cs_mode = SRAM_CS_DEFAULT);
+#if DEVICE_QSPI
+    // One chip in SQI mode on a QSPI peripheral, which drives CS itself.
+    // The async calls complete before they return on this transport.
+    SRAMsimple(QSPI& qspi_param);
+#endif
     ~SRAMsimple();
-    void SetMode(uint32_t Mode);
-    void ReadMode();
+    void SetMode(uint32_t Mode);      // skipped when the chips are already in Mode
+    uint8_t ReadMode();               // RDSR; refreshes the mode cache and returns it
+    uint32_t Size();                  // combined capacity in bytes
     void WriteWord(uint32_t address, uint32_t data_byte);
     uint32_t ReadWord(uint32_t address);
-    // void WriteByteArray(uint32_t address, byte *data, uint16_t big);
-    // void ReadByteArray(uint32_t address, byte *data, uint16_t big);
-    // void WriteInt(uint32_t address, int data);  
-    // int ReadInt(uint32_t address);
-    // void WriteIntArray(uint32_t address, int *data, uint16_t big);
-    // void ReadIntArray(uint32_t address, int *data, uint16_t big);
-    // void WriteUnsignedInt(uint32_t address, unsigned int data);
-    // unsigned int ReadUnsignedInt(uint32_t address);
-    // void WriteUnsignedIntArray(uint32_t address, unsigned int *data, uint16_t big);
-    // void ReadUnsignedIntArray(uint32_t address, unsigned int *data, uint16_t big);
-    // void WriteLong(uint32_t address, long data);
-    // long ReadLong(uint32_t address);
-    // void WriteLongArray(uint32_t address, long *data, uint16_t big);
-    // void ReadLongArray(uint32_t address, long *data, uint16_t big);
-    // void WriteUnsignedLong(uint32_t address, unsigned long data);
-    // unsigned long ReadUnsignedLong(uint32_t address);
-    // void WriteUnsignedLongArray(uint32_t address, unsigned long *data, uint16_t big);
-    // void ReadUnsignedLongArray(uint32_t address, unsigned long *data, uint16_t big);
-    // void WriteFloat(uint32_t address, float data);
-    // float ReadFloat(uint32_t address);
-    // void WriteFloatArray(uint32_t address, float *data, uint16_t big);
-    // void ReadFloatArray(uint32_t address, float *data, uint16_t big);
+    uint32_t SRAMMalloc(size_t size);
+    void SRAMFree(uint32_t address);
+    uint32_t SRAMClaim(uint32_t address, size_t size);   // re-allocates data that is already in place
+    bool SRAMShrink(uint32_t address, size_t size);       // keeps the first size bytes of an allocation
+    SRAMHeapStats HeapStats();
+    void SpiWriteByteArray(uint32_t address, const uint8_t *data, size_t size);
+    void SpiReadByteArray(uint32_t address, size_t size, uint8_t* readarray);
+    // Streaming access: one command, then any number of data calls with CS held low
+    void BeginWrite(uint32_t address);
+    void BeginRead(uint32_t address);
+    void BeginFastRead(uint32_t address);   // HSREAD
+    void WriteBytes(const uint8_t *data, size_t size);
+    void ReadBytes(uint8_t *data, size_t size);
+    void EndTransaction();
+    // Batches of small records: the descriptors are sorted by address (stably,
+    // in place) and neighbouring ranges share one sequential burst. Returns
+    // the number of bursts. WriteV only merges ranges that touch, and its
+    // ranges must not overlap.
+    size_t ReadV(SRAMIoVec *vec, size_t count);
+    size_t WriteV(SRAMIoVec *vec, size_t count);
+    // Moves inside the SRAM, through the loader buffers. SramCopy copies front
+    // to back, SramMove also handles overlapping ranges, and SramFill writes
+    // value over size bytes in one sequential WRITE.
+    void SramCopy(uint32_t dst, uint32_t src, size_t size);
+    void SramMove(uint32_t dst, uint32_t src, size_t size);
+    void SramFill(uint32_t address, uint8_t value, size_t size);
+    bool WriteFileInChunks(const char* filepath, size_t chunk_size = 32*100);
+    // Loads several files back to back without draining the pipeline between
+    // them. Returns the number loaded; a file that fails gets the address
+    // SRAM_ALLOC_FAIL in regions. model_data is the last file loaded.
+    size_t WriteFilesInChunks(const char *const *paths, SRAMRegion *regions, size_t count, size_t chunk_size = 32*100);
+    // CRC-32 (IEEE, as zlib's crc32); pass the previous result to continue one
+    static uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size);
+    uint32_t Crc(uint32_t address, size_t size);    // of SRAM contents, read in loader-sized bursts
+    bool Verify(const SRAMRegion &region);          // true when region.crc still matches
+    // Checks the next blocks of model_data against the CRCs taken while
+    // loading, wrapping around; cheap enough to call from an idle loop.
+    // Returns false when a block did not match.
+    bool VerifySample(uint32_t blocks = 1);
+    // Warm boot: the used part of the SRAM, the heap's allocations and
+    // model_data in one file. An incremental save rewrites the pages written
+    // since the last save or load of the same file, and makes a full one when
+    // the file is not that one. LoadSnapshot replaces the heap and the
+    // contents of the SRAM; model_data and its block CRCs come back too.
+    bool SaveSnapshot(const char *path, bool incremental = false);
+    bool LoadSnapshot(const char *path);
+#if DEVICE_SPI_ASYNCH
+    // Non-blocking transfers on SPI::transfer. They return a handle, or 0 when
+    // SRAM_ASYNC_DEPTH requests are already queued. The buffer must stay valid
+    // until the request completes; the callback runs in interrupt context.
+    // Queuing from a callback needs the chips in a mode that fits the request
+    // already, as a mode change has to wait for the queue to drain.
+    uint32_t WriteAsync(uint32_t address, const uint8_t *data, size_t size, const event_callback_t &callback = nullptr);
+    uint32_t ReadAsync(uint32_t address, uint8_t *data, size_t size, const event_callback_t &callback = nullptr);
+    bool AsyncDone(uint32_t handle);
+    void AsyncWait(uint32_t handle);
+    void AsyncFlush();
+    uint32_t AsyncPending();
+#endif
+#if SRAM_STATS
+    SRAMStats GetStats();             // a consistent copy, also against the async completions
+    void ResetStats();
+    void StatsDump();                 // prints the counters and non-empty histogram buckets on Serial
+#endif
+#if SRAM_TRACE
+    size_t TraceRead(SRAMTraceEntry *out, size_t max);   // oldest entry first
+    void TraceDump();                                     // prints the ring on Serial
+    void TraceClear();
+#endif
     static SRAMsimple * getInstance() {
         return _inst;
     };
 };
 
+// Every transaction drives CS through these, so they stay inline
+inline void SRAMsimple::Select(uint8_t chip) {
+#if SRAM_STATS
+  _stats.transactions++;
+#endif
+  switch (_cs_mode) {
+  case SRAM_CS_GPIO:
+#if defined(TARGET_STM)
+    *_cs_gpio[chip].reg_set = _cs_gpio[chip].mask << 16;   // high half of BSRR resets the pin
+#else
+    gpio_write(&_cs_gpio[chip], 0);
+#endif
+    break;
+  case SRAM_CS_DIGITALOUT:
+    _cs_out[chip]->write(0);
+    break;
+  case SRAM_CS_DIGITALWRITE:
+    digitalWrite(_cs[chip], LOW);
+    break;
+  }                                   // SRAM_CS_HARDWARE: the peripheral drives NSS
+}
+
+inline void SRAMsimple::Deselect(uint8_t chip) {
+  switch (_cs_mode) {
+  case SRAM_CS_GPIO:
+#if defined(TARGET_STM)
+    *_cs_gpio[chip].reg_set = _cs_gpio[chip].mask;
+#else
+    gpio_write(&_cs_gpio[chip], 1);
+#endif
+    break;
+  case SRAM_CS_DIGITALOUT:
+    _cs_out[chip]->write(1);
+    break;
+  case SRAM_CS_DIGITALWRITE:
+    digitalWrite(_cs[chip], HIGH);
+    break;
+  }
+}
+
+#if SRAM_STATS
+// A few instructions: one clock read, three increments and a count of leading zeros
+inline void SRAMsimple::Record(uint8_t op, uint32_t bytes, uint32_t start) {
+  uint32_t ticks = SRAM_STATS_CLOCK() - start;
+  SRAMOpStats &stats = _stats.op[op];
+  stats.count++;
+  stats.bytes += bytes;
+  stats.latency[31 - __builtin_clz(ticks | 1)]++;
+}
+#endif
+
+// One streaming command as a scope: BeginWrite/BeginRead/BeginFastRead on
+// construction and EndTransaction when it goes out of scope. op is WRITE,
+// READ or HSREAD; size, when known, lets the chips stay in page or byte mode.
+class SRAMtransaction {
+  public:
+    SRAMtransaction(SRAMsimple &sram, uint32_t op, uint32_t address, size_t size = 0) : _sram(sram) {
+      _sram.BeginTransaction(op, address, size);
+    }
+    ~SRAMtransaction() { _sram.EndTransaction(); }
+    void Write(const uint8_t *data, size_t size) { _sram.WriteBytes(data, size); }
+    void Read(uint8_t *data, size_t size) { _sram.ReadBytes(data, size); }
+  private:
+    SRAMsimple &_sram;
+};
+
 #endif
@@ -25,11 +25,16 @@
    Pin8 (V+)  -- +5V
 */
 
-#include <SRAMsimple.h>
+#include "SRAMsimple.h"
+#include "SRAMarray.h"
+#include "mbed.h"
+#include "Arduino.h"
+using namespace mbed;
 
-#define CSPIN 10       // Default Chip Select Line for Uno (change as needed)
+#define CSPIN PI_0     // Chip select used by SRAMsimple.cpp (change as needed)
 
-SRAMsimple sram;       // initialize an instance of this class
+SPI spi(PC_3, PC_2, PI_1);  // MOSI,MISO,SCK, (CS is driven by the library)
+SRAMsimple sram(spi);       // initialize an instance of this class
 
 /*******************  Create some dummy data to read and space to write  ******************/
 byte a[20] = {"abcdefghijklmnopqrs"};         // array data to write
@@ -46,79 +51,52 @@ long read_data_d[5];                          // array to hold data read from me
 unsigned long read_data_e[5];                 // array to hold data read from memory
 float read_data_f[5];                         // array to hold data read from memory
 
+// One SramArray per type replaces the old Write<Type>Array/Read<Type>Array pairs;
+// each Write or Read is a single burst straight from or into the array.
+template <typename T>
+void RoundTrip(const char *name, const T *data, T *read_data, size_t count)
+{
+  SramArray<T> arr(sram, 0, count);           // count elements of T starting at address 0
+  Serial.print("\nWriting ");
+  Serial.print(name);
+  Serial.println(" array: ");
+  arr.Write(data, count);
+  Serial.print("Reading ");
+  Serial.print(name);
+  Serial.println(" array: ");
+  arr.Read(read_data, count);
+  for(size_t i=0; i<count; i++){              // Output read data to serial monitor
+    Serial.println(read_data[i]);
+  }
+}
+
 void setup()
 {
-  uint32_t address = 0;                       // create a 32 bit variable to hold the address (uint32_t=long)
-  byte value;                                 // create variable to hold the data value read
-  byte data;                                  // create variable to hold the data value sent
+  pinMode(CSPIN, OUTPUT);
+  digitalWrite(CSPIN, HIGH);
   Serial.begin(9600);                         // set communication speed for the serial monitor
-  SPI.begin();                                // start communicating with the memory chip
-    
-/************  Write a Sequence of Bytes from an Array *******************/
-  Serial.println("\nWriting byte array using Sequential: ");
-  sram.WriteByteArray(0, a, sizeof(a));        // Write array e to memory starting at address 0
 
-/************ Read a Sequence of Bytes from Memory into an Array **********/
+/************  Write and Read a Sequence of Bytes *******************/
+  Serial.println("\nWriting byte array using Sequential: ");
+  sram.SpiWriteByteArray(0, a, sizeof(a));     // Write array a to memory starting at address 0
   Serial.println("Reading byte array using sequential: ");
-  sram.ReadByteArray(0, read_data_a, sizeof(read_data_a));   // Read array into read_data_a starting at address 0
-  for(int i=0; i<sizeof(read_data_a); i++){     // print the array
+  sram.SpiReadByteArray(0, sizeof(read_data_a), read_data_a);   // Read array into read_data_a starting at address 0
+  for(size_t i=0; i<sizeof(read_data_a); i++){  // print the array
     Serial.println((char)read_data_a[i]);       // We need to cast it as a char
   }                                             // to make it print as a character
 
-/************  Write an Integer Array *******************/
-  Serial.println("\nWriting integer array using Sequential: ");
-  sram.WriteIntArray(0, b, 5);                  // Write array b to memory starting at address 0
-                                               
-/************ Read an Integer Array **********/
-  Serial.println("Reading integer array using sequential: ");
-  sram.ReadIntArray(0, read_data_b, 5);   // Read from memory into empty array read_data_b
-  for(int i=0; i<5; i++){                 // Output read data to serial monitor
-    Serial.println(read_data_b[i]);         
-  } 
-
-/************  Write an Unsigned Integer Array *******************/
-  Serial.println("\nWriting unsigned integer array using Sequential: ");
-  sram.WriteUnsignedIntArray(0, c, 5);     // Use the array of characters defined in z above
-                                               // write to memory starting at address 0
-/************ Read an Unsigned Integer Array **********/
-  Serial.println("Reading unsigned integer array using sequential: ");
-  sram.ReadUnsignedIntArray(0, read_data_c, 5);  // Read from memory into empty array read_data_c
-  for(int i=0; i<5; i++){                        // Output read data to serial monitor
-    Serial.println(read_data_c[i]);         
-  } 
-
-/************  Write a Long Array *******************/
-  Serial.println("\nWriting long array: ");
-  sram.WriteLongArray(0, d, 5);                  // Write array d to memory starting at address 0
-
-/************ Read a Long Array **********/
-  Serial.println("Reading long array: ");
-  sram.ReadLongArray(0, read_data_d, 5);       // Read from memory into empty array read_data_d
-  for(int i=0; i<5; i++){                      // Output read data to serial monitor
-    Serial.println(read_data_d[i]);         
-  } 
-
-/************  Write an Unsigned Long Array *******************/
-  Serial.println("\nWriting unsigned long array: ");
-  sram.WriteUnsignedLongArray(0, e, 5);        // Write array e to memory starting at address 0
-
-/************ Read an Unsigned Long Array **********/
-  Serial.println("Reading unsigned long array: ");
-  sram.ReadUnsignedLongArray(0, read_data_e, 5);   // Read from memory into empty array read_data_e
-  for(int i=0; i<5; i++){                          // Output read data to serial monitor
-    Serial.println(read_data_e[i]);         
-  }
-
-/************  Write a Float Array *******************/
-  Serial.println("\nWriting float array: ");
-  sram.WriteFloatArray(0, f, 5);                 // Write array f to memory starting at address 0
-
-/************ Read Float Array **********/
-  Serial.println("Reading float array: ");
-  sram.ReadFloatArray(0, read_data_f, 5);       // Read from memory into empty array read_data_f
-  for(int i=0; i<5; i++){                       // Output read data to serial monitor
-    Serial.println(read_data_f[i]);         
-  }
+/************  Write and Read typed arrays *******************/
+  RoundTrip("integer", b, read_data_b, 5);
+  RoundTrip("unsigned integer", c, read_data_c, 5);
+  RoundTrip("long", d, read_data_d, 5);
+  RoundTrip("unsigned long", e, read_data_e, 5);
+  RoundTrip("float", f, read_data_f, 5);
+
+/************  Single elements through the proxy *******************/
+  SramArray<float> floats(sram, 0, 5);
+  floats[4] = 1.23;                             // writes one float to SRAM
+  float x = floats[4];                          // reads it back
+  Serial.println(x);
 }
 
 void loop()
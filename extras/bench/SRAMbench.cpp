@@ -0,0 +1,1322 @@
+/*  SRAMbench.cpp - Host benchmark for SRAMsimple against the 23AA04M model.
+ *  Counts SPI driver calls, frames and CS transactions per operation and
+ *  reports modeled time and throughput, so changes to SRAMsimple.cpp can be
+ *  compared without a board. "viol" is the number of protocol violations the
+ *  chip model saw, plus blocking SPI calls made inside a critical section, and
+ *  "bad" the number of bytes that did not round-trip.
+ *
+ *  Build and run from the library root:
+ *    g++ -std=gnu++14 -O2 -pthread -I. -Iextras/host SRAMsimple.cpp SRAMheap.cpp \
+ *        SRAMcache.cpp SRAMarena.cpp SRAMreader.cpp SRAMscheduler.cpp SRAMdirectory.cpp SRAMpager.cpp SRAMlz.cpp SRAMring.cpp \
+ *        extras/host/HostArduino.cpp \
+ *        extras/host/HostBus.cpp extras/host/HostMbed.cpp extras/host/SRAM23AA04M.cpp \
+ *        extras/bench/SRAMbench.cpp -o SRAMbench && ./SRAMbench
+ *  Add -DSRAM_TRACE=1 to run with the command trace ring recording, or
+ *  -DSRAM_TRACE=2 for the Serial logging of every word access as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SRAMsimple.h"
+#include "SRAMcache.h"
+#include "SRAMarena.h"
+#include "SRAMarray.h"
+#include "SRAMreader.h"
+#include "SRAMscheduler.h"
+#include "SRAMdirectory.h"
+#include "SRAMpager.h"
+#include "SRAMlz.h"
+#include "SRAMring.h"
+#include "SRAM23AA04M.h"
+
+static const uint32_t kCsPin = SRAM_CS_PIN; // CS of the single-chip constructors
+
+static SRAM23AA04M chip;
+static SRAM23AA04M chip_b;                  // second chip for the multi-chip runs
+static const uint32_t kCsPinB = 0x82;
+static double start_ns;
+
+static void Begin() {
+  host::ResetStats();
+  chip.ClearCounters();
+  start_ns = host::Now();
+}
+
+static double End(const char *name, uint32_t ops, uint32_t bytes, uint32_t bad) {
+  const host::BusStats &s = host::Stats();
+  double total_ns = host::Now() - start_ns;
+  printf("%-28s %6u %8u %8.1f %8.1f %6.2f %10.2f %10.2f %10.1f %5u %6u\n",
+         name, ops, bytes,
+         (double)s.spi_calls / ops, (double)s.frames / ops, (double)s.cs_low / ops,
+         total_ns / ops / 1000.0, s.serial_ns / ops / 1000.0,
+         bytes / (total_ns / 1e9) / 1024.0, chip.Errors() + (uint32_t)s.critical_calls, bad);
+  return total_ns;
+}
+
+static uint32_t Compare(uint32_t address, const uint8_t *expect, size_t size) {
+  uint32_t bad = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (chip.Memory()[(address + i) % SRAM23AA04M::kSize] != expect[i]) bad++;
+  }
+  return bad;
+}
+
+// The original byte-array transfer: one SPI::write per byte on 8-bit frames,
+// kept as the reference the block path is measured against
+static void PerByteWrite(SPI &spi, uint32_t address, const uint8_t *data, size_t size) {
+  spi.format(8, 0);
+  digitalWrite(kCsPin, LOW);
+  spi.write(0x02);
+  spi.write((uint8_t)(address >> 16));
+  spi.write((uint8_t)(address >> 8));
+  spi.write((uint8_t)address);
+  for (size_t i = 0; i < size; i++) spi.write(data[i]);
+  digitalWrite(kCsPin, HIGH);
+}
+
+static void PerByteRead(SPI &spi, uint32_t address, uint8_t *data, size_t size) {
+  spi.format(8, 0);
+  digitalWrite(kCsPin, LOW);
+  spi.write(0x03);
+  spi.write((uint8_t)(address >> 16));
+  spi.write((uint8_t)(address >> 8));
+  spi.write((uint8_t)address);
+  for (size_t i = 0; i < size; i++) data[i] = (uint8_t)spi.write(0);
+  digitalWrite(kCsPin, HIGH);
+}
+
+// Byte at a linear address of a two-chip SRAMsimple, read from the models
+static uint8_t PairByte(uint8_t layout, uint32_t address) {
+  SRAM23AA04M *chips[2] = {&chip, &chip_b};
+  if (layout == SRAM_CONCAT) return chips[address / SRAM23AA04M::kSize]->Memory()[address % SRAM23AA04M::kSize];
+  uint32_t stripe = address / SRAM_STRIPE_SIZE;
+  return chips[stripe % 2]->Memory()[(stripe / 2) * SRAM_STRIPE_SIZE + address % SRAM_STRIPE_SIZE];
+}
+
+static void LegacySetMode(SPI &spi, uint8_t status) {
+  spi.format(8, 0);
+  digitalWrite(kCsPin, LOW);
+  spi.write(0x01);
+  spi.write(status);
+  digitalWrite(kCsPin, HIGH);
+}
+
+static void Fill(uint8_t *buf, size_t size, uint32_t seed) {
+  for (size_t i = 0; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = (uint8_t)(seed >> 16);
+  }
+}
+
+// Modeled microseconds at the given fraction of the sorted samples
+static double Percentile(std::vector<double> &ns, double fraction) {
+  if (ns.empty()) return 0;
+  std::sort(ns.begin(), ns.end());
+  return ns[(size_t)(fraction * (ns.size() - 1))] / 1000.0;
+}
+
+#if SRAM_STATS
+// Upper bound, in microseconds, of the histogram bucket holding the given fraction of the samples
+static double BucketPercentile(const SRAMOpStats &op, uint32_t clock_hz, double fraction) {
+  uint32_t seen = 0;
+  for (int b = 0; b < SRAM_STAT_BUCKETS; b++) {
+    seen += op.latency[b];
+    if (seen > 0 && seen >= fraction * op.count) return (double)(2ull << b) * 1e6 / clock_hz;
+  }
+  return 0;
+}
+#endif
+
+int main() {
+  host::Attach(kCsPin, &chip);
+  Serial.begin(115200);
+
+  SPI spi(PC_3, PC_2, PI_1);
+  SRAMsimple sram(spi);
+
+  static uint8_t data[0x10000];
+  static uint8_t back[0x10000];
+  Fill(data, sizeof(data), 1);
+
+  printf("%-28s %6s %8s %8s %8s %6s %10s %10s %10s %5s %6s\n",
+         "operation", "ops", "bytes", "calls/op", "frames/op", "cs/op",
+         "us/op", "serial us", "KB/s", "viol", "bad");
+
+  const uint32_t kWords = 1000;
+  Begin();
+  for (uint32_t i = 0; i < kWords; i++) sram.WriteWord(i * 4, 0xA5000000u + i);
+  uint32_t bad = 0;
+  for (uint32_t i = 0; i < kWords; i++) {
+    uint8_t *m = chip.Memory() + i * 4;
+    uint32_t v = ((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint32_t)m[2] << 8) | m[3];
+    if (v != 0xA5000000u + i) bad++;
+  }
+  End("WriteWord", kWords, kWords * 4, bad);
+
+  Begin();
+  bad = 0;
+  for (uint32_t i = 0; i < kWords; i++) {
+    if (sram.ReadWord(i * 4) != 0xA5000000u + i) bad++;
+  }
+  End("ReadWord", kWords, kWords * 4, bad);
+#if SRAM_TRACE
+  SRAMTraceEntry last[2];
+  bad = sram.TraceRead(last, 2) != 2 || last[0].op != 0x03 || last[0].address != (kWords - 2) * 4 ||
+        last[1].address != (kWords - 1) * 4 || last[1].length != 4;
+  printf("  trace ring (level %d, %d entries): %s\n", SRAM_TRACE, SRAM_TRACE_DEPTH, bad ? "FAILED" : "ok");
+#endif
+
+  const uint32_t kBlock = 3200, kBlocks = 20;
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) PerByteWrite(spi, i * kBlock, data + i * kBlock, kBlock);
+  double per_byte_write = End("per-byte write 3200B (ref)", kBlocks, kBlocks * kBlock, Compare(0, data, kBlocks * kBlock));
+
+  memset(chip.Memory(), 0, kBlocks * kBlock);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) sram.SpiWriteByteArray(i * kBlock, data + i * kBlock, kBlock);
+  double block_write = End("SpiWriteByteArray 3200B", kBlocks, kBlocks * kBlock, Compare(0, data, kBlocks * kBlock));
+
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) PerByteRead(spi, i * kBlock, back + i * kBlock, kBlock);
+  bad = 0;
+  for (uint32_t i = 0; i < kBlocks * kBlock; i++) bad += back[i] != data[i];
+  double per_byte_read = End("per-byte read 3200B (ref)", kBlocks, kBlocks * kBlock, bad);
+
+  memset(back, 0, sizeof(back));
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) sram.SpiReadByteArray(i * kBlock, kBlock, back + i * kBlock);
+  bad = 0;
+  for (uint32_t i = 0; i < kBlocks * kBlock; i++) bad += back[i] != data[i];
+  double block_read = End("SpiReadByteArray 3200B", kBlocks, kBlocks * kBlock, bad);
+  printf("  block transfer speedup: write %.1fx, read %.1fx\n",
+         per_byte_write / block_write, per_byte_read / block_read);
+
+  // Typed arrays: native layout should cost the same as the raw byte path
+  static float floats[kBlocks * kBlock / 4], floats_back[kBlocks * kBlock / 4];
+  for (uint32_t i = 0; i < kBlocks * kBlock / 4; i++) floats[i] = i * 0.5f;
+  SramArray<float> float_array(sram, 0, kBlocks * kBlock / 4);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) float_array.Write(floats + i * kBlock / 4, kBlock / 4, i * kBlock / 4);
+  End("SramArray<float>::Write 3200B", kBlocks, kBlocks * kBlock, Compare(0, (const uint8_t *)floats, kBlocks * kBlock));
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) float_array.Read(floats_back + i * kBlock / 4, kBlock / 4, i * kBlock / 4);
+  End("SramArray<float>::Read 3200B", kBlocks, kBlocks * kBlock, memcmp(floats, floats_back, sizeof(floats)) != 0);
+
+  static int32_t ints[kBlock / 4], ints_back[kBlock / 4];
+  for (uint32_t i = 0; i < kBlock / 4; i++) ints[i] = (int32_t)(i * 65537) - 1000;
+  SramArray<int32_t, SRAM_BIG_ENDIAN> be_array(sram, 0, kBlock / 4);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) be_array.Write(ints, kBlock / 4);
+  bad = 0;
+  for (uint32_t i = 0; i < kBlock / 4; i++) {
+    const uint8_t *m = chip.Memory() + i * 4;
+    bad += (int32_t)(((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint32_t)m[2] << 8) | m[3]) != ints[i];
+  }
+  End("SramArray<int32_t,BE>::Write", kBlocks, kBlocks * kBlock, bad);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) be_array.Read(ints_back, kBlock / 4);
+  End("SramArray<int32_t,BE>::Read", kBlocks, kBlocks * kBlock, memcmp(ints, ints_back, sizeof(ints)) != 0);
+
+  SramArray<int32_t, SRAM_BIG_ENDIAN> small(sram, 0, 16);
+  int64_t sum = 0;
+  for (int32_t v : small) sum += v;
+  small[0] = small[1];
+  bad = sum != 120 * 65537 - 16000 || (int32_t)small[0] != ints[1] || (small.end() - small.begin()) != 16;
+  printf("  typed element access (proxy, iteration): %s\n", bad ? "FAILED" : "ok");
+
+  const uint32_t kSmall = 32, kSmalls = 200;
+  Begin();
+  for (uint32_t i = 0; i < kSmalls; i++) sram.SpiWriteByteArray(0x10000 + i * kSmall, data + i * kSmall, kSmall);
+  double small_write = End("SpiWriteByteArray 32B", kSmalls, kSmalls * kSmall, Compare(0x10000, data, kSmalls * kSmall));
+
+  // The legacy calling pattern, SetMode(Sequential) before every access
+  memset(chip.Memory() + 0x10000, 0, kSmalls * kSmall);
+  Begin();
+  for (uint32_t i = 0; i < kSmalls; i++) {
+    LegacySetMode(spi, 0x40);
+    sram.SpiWriteByteArray(0x10000 + i * kSmall, data + i * kSmall, kSmall);
+  }
+  double legacy_write = End("32B + WRSR each (ref)", kSmalls, kSmalls * kSmall, Compare(0x10000, data, kSmalls * kSmall));
+  memset(chip.Memory() + 0x10000, 0, kSmalls * kSmall);
+  Begin();
+  for (uint32_t i = 0; i < kSmalls; i++) {
+    sram.SetMode(Sequential);
+    sram.SpiWriteByteArray(0x10000 + i * kSmall, data + i * kSmall, kSmall);
+  }
+  End("32B + SetMode each, cached", kSmalls, kSmalls * kSmall,
+      Compare(0x10000, data, kSmalls * kSmall) + (chip.Commands(SRAM23AA04M::kWrsr) != 0));
+
+  // Mode picked per request: in-page runs keep page mode, a page-crossing one
+  // switches to sequential, and nothing switches back
+  sram.SetMode(PageMode);
+  Begin();
+  sram.SpiWriteByteArray(0x10000, data, 16);
+  sram.SpiWriteByteArray(0x10010, data + 16, 16);
+  sram.WriteWord(0x10020, 0x01020304);
+  bad = chip.Commands(SRAM23AA04M::kWrsr) != 0;
+  sram.SpiWriteByteArray(0x10030, data, 40);
+  sram.SpiWriteByteArray(0x10040, data, 1);
+  bad += chip.Commands(SRAM23AA04M::kWrsr) != 1 || sram.ReadMode() != 0x40 || Compare(0x10000, data, 16) != 0 ||
+         Compare(0x10040, data, 1) != 0 || chip.Errors() != 0;
+  printf("  mode cache: %.2fx vs WRSR per access, automatic page/sequential switch: %s\n",
+         legacy_write / small_write, bad ? "FAILED" : "ok");
+
+  // 64 struct-sized records (20 bytes) in shuffled order: packed back to back
+  // for the writes, 24 bytes apart for the reads
+  const uint32_t kRecords = 64, kRecord = 20;
+  SRAMIoVec vec[kRecords];
+  uint32_t order[kRecords];
+  for (uint32_t i = 0; i < kRecords; i++) order[i] = i;
+  for (uint32_t i = kRecords - 1, r = 12345; i > 0; i--) {
+    r = r * 1103515245 + 12345;
+    uint32_t j = (r >> 16) % (i + 1), t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  memset(chip.Memory() + 0x11000, 0, kRecords * kRecord);
+  Begin();
+  for (uint32_t i = 0; i < kRecords; i++) {
+    sram.SpiWriteByteArray(0x11000 + order[i] * kRecord, data + order[i] * kRecord, kRecord);
+  }
+  double record_writes = End("64 records, SpiWriteByteArray", kRecords, kRecords * kRecord,
+                             Compare(0x11000, data, kRecords * kRecord));
+  memset(chip.Memory() + 0x11000, 0, kRecords * kRecord);
+  for (uint32_t i = 0; i < kRecords; i++) vec[i] = { 0x11000 + order[i] * kRecord, data + order[i] * kRecord, kRecord };
+  Begin();
+  size_t bursts = sram.WriteV(vec, kRecords);
+  double vec_writes = End("64 records, WriteV", kRecords, kRecords * kRecord,
+                          Compare(0x11000, data, kRecords * kRecord) + (bursts != 1));
+
+  for (uint32_t i = 0; i < kRecords; i++) memcpy(chip.Memory() + 0x12000 + i * 24, data + i * kRecord, kRecord);
+  memset(back, 0, kRecords * kRecord);
+  Begin();
+  for (uint32_t i = 0; i < kRecords; i++) {
+    sram.SpiReadByteArray(0x12000 + order[i] * 24, kRecord, back + order[i] * kRecord);
+  }
+  double record_reads = End("64 records, SpiReadByteArray", kRecords, kRecords * kRecord,
+                            memcmp(back, data, kRecords * kRecord) != 0);
+  memset(back, 0, kRecords * kRecord);
+  for (uint32_t i = 0; i < kRecords; i++) vec[i] = { 0x12000 + order[i] * 24, back + order[i] * kRecord, kRecord };
+  Begin();
+  bursts = sram.ReadV(vec, kRecords);
+  double vec_reads = End("64 records, ReadV", kRecords, kRecords * kRecord,
+                         (memcmp(back, data, kRecords * kRecord) != 0) + (bursts != 1));
+  static uint8_t part[4][300];
+  SRAMIoVec mixed[4] = { { 0x12005, part[0], 10 }, { 0x12000, part[1], 300 },
+                         { 0x12134, part[2], 7 }, { 0x12128, part[3], 8 } };   // overlap, large, gap
+  bursts = sram.ReadV(mixed, 4);
+  bad = bursts != 3;
+  for (uint32_t i = 0; i < 4; i++) bad += memcmp(mixed[i].data, chip.Memory() + mixed[i].address, mixed[i].size) != 0;
+
+  // Random batches against a reference copy of a 4 KB window: WriteV of
+  // disjoint ranges in shuffled order, ReadV of ranges that may overlap,
+  // touch or leave gaps; sizes on both sides of SRAM_GATHER_BUFFER
+  static uint8_t reference[4096];
+  static uint8_t landing[16][400];
+  const uint32_t kWindow = 0x13000;
+  memcpy(reference, chip.Memory() + kWindow, sizeof(reference));
+  uint32_t random_bad = 0;
+  uint32_t r = 777;
+  auto random = [&r](uint32_t n) { r = r * 1103515245 + 12345; return (r >> 8) % n; };
+  for (uint32_t round = 0; round < 500; round++) {
+    uint32_t n = 0;
+    for (uint32_t pos = random(64); n < 16; n++) {
+      pos += random(3) == 0 ? 0 : random(40);
+      uint32_t size = 1 + random(n % 4 == 0 ? 300 : 40);
+      if (pos + size > sizeof(reference)) break;
+      memcpy(landing[n], data + random(0x10000 - size), size);
+      memcpy(reference + pos, landing[n], size);
+      vec[n] = { kWindow + pos, landing[n], size };
+      pos += size;
+    }
+    for (uint32_t i = n; i > 1; i--) {
+      uint32_t j = random(i);
+      SRAMIoVec t = vec[i - 1];
+      vec[i - 1] = vec[j];
+      vec[j] = t;
+    }
+    sram.WriteV(vec, n);
+    random_bad += Compare(kWindow, reference, sizeof(reference)) != 0;
+
+    n = 1 + random(16);
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t size = 1 + random(i % 4 == 0 ? 300 : 40);
+      vec[i] = { kWindow + random(sizeof(reference) - size), landing[i], size };
+    }
+    sram.ReadV(vec, n);
+    for (uint32_t i = 0; i < n; i++) {
+      random_bad += memcmp(vec[i].data, reference + vec[i].address - kWindow, vec[i].size) != 0;
+    }
+  }
+  printf("  scatter/gather: write %.2fx, read %.2fx, mixed batch: %s, 500 random batches: %s\n",
+         record_writes / vec_writes, record_reads / vec_reads, bad ? "FAILED" : "ok", random_bad ? "FAILED" : "ok");
+
+  // Sensor loop: store each 3200-byte chunk while processing the next one
+  const double kWorkNs = 400000;
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) {
+    sram.SpiWriteByteArray(0x20000 + i * kBlock, data + i * kBlock, kBlock);
+    host::Compute(kWorkNs);
+  }
+  double sync_loop = End("store + 400us work, blocking", kBlocks, kBlocks * kBlock,
+                         Compare(0x20000, data, kBlocks * kBlock));
+
+  static volatile uint32_t callbacks;
+  callbacks = 0;
+  memset(chip.Memory() + 0x20000, 0, kBlocks * kBlock);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) {
+    uint32_t handle = sram.WriteAsync(0x20000 + i * kBlock, data + i * kBlock, kBlock,
+                                      [](int event) { if (event & SPI_EVENT_COMPLETE) callbacks++; });
+    host::Compute(kWorkNs);
+    sram.AsyncWait(handle);
+    host::WaitBus();
+  }
+  double async_loop = End("store + 400us work, WriteAsync", kBlocks, kBlocks * kBlock,
+                          Compare(0x20000, data, kBlocks * kBlock) + (kBlocks - callbacks));
+
+  memset(back, 0, sizeof(back));
+  uint32_t handles[SRAM_ASYNC_DEPTH];
+  Begin();
+  core_util_critical_section_enter();             // hold off completions until the queue is full
+  for (uint32_t i = 0; i < SRAM_ASYNC_DEPTH; i++) {
+    handles[i] = sram.ReadAsync(0x20000 + i * kBlock, back + i * kBlock, kBlock);
+  }
+  bad = sram.ReadAsync(0, back, 1) != 0;
+  core_util_critical_section_exit();
+  sram.AsyncFlush();
+  host::WaitBus();
+  for (uint32_t i = 0; i < SRAM_ASYNC_DEPTH; i++) bad += !sram.AsyncDone(handles[i]);
+  for (uint32_t i = 0; i < SRAM_ASYNC_DEPTH * kBlock; i++) bad += back[i] != data[i];
+  End("ReadAsync 3200B, full queue", SRAM_ASYNC_DEPTH, SRAM_ASYNC_DEPTH * kBlock, bad);
+  printf("  async overlap speedup: %.2fx\n", sync_loop / async_loop);
+
+  // Scattered word accesses: 90% inside a 1 KB hot set, the rest over 64 KB,
+  // half of them writes. A shadow copy checks the final contents.
+  const uint32_t kAccesses = 4000, kBase = 0x50000;
+  static uint32_t addr[kAccesses], value[kAccesses];
+  static uint8_t shadow[0x10000];
+  uint32_t seed = 7;
+  for (uint32_t i = 0; i < kAccesses; i++) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t span = (seed >> 8) % 10 ? 0x400 : 0x10000;
+    addr[i] = ((seed >> 12) % span) & ~3u;
+    value[i] = (seed & 1) ? seed : 0;            // 0: read
+  }
+  memset(chip.Memory() + kBase, 0, sizeof(shadow));
+  memset(shadow, 0, sizeof(shadow));
+  Begin();
+  for (uint32_t i = 0; i < kAccesses; i++) {
+    uint8_t w[4] = { (uint8_t)(value[i] >> 24), (uint8_t)(value[i] >> 16), (uint8_t)(value[i] >> 8), (uint8_t)value[i] };
+    if (value[i]) {
+      sram.SpiWriteByteArray(kBase + addr[i], w, 4);
+      memcpy(shadow + addr[i], w, 4);
+    } else {
+      sram.SpiReadByteArray(kBase + addr[i], 4, w);
+    }
+  }
+  End("scattered words, uncached", kAccesses, kAccesses * 4, Compare(kBase, shadow, sizeof(shadow)));
+
+  memset(chip.Memory() + kBase, 0, sizeof(shadow));
+  memset(shadow, 0, sizeof(shadow));
+  static SRAMcache cache(sram);
+  Begin();
+  bad = 0;
+  for (uint32_t i = 0; i < kAccesses; i++) {
+    if (value[i]) {
+      cache.WriteWord(kBase + addr[i], value[i]);
+      uint8_t *m = shadow + addr[i];
+      m[0] = value[i] >> 24; m[1] = value[i] >> 16; m[2] = value[i] >> 8; m[3] = value[i];
+    } else {
+      const uint8_t *m = shadow + addr[i];
+      uint32_t expect = ((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint32_t)m[2] << 8) | m[3];
+      bad += cache.ReadWord(kBase + addr[i]) != expect;
+    }
+  }
+  cache.Flush();
+  End("scattered words, SRAMcache", kAccesses, kAccesses * 4, bad + Compare(kBase, shadow, sizeof(shadow)));
+  printf("  cache: %u hits, %u misses, %u evictions, %u write-backs\n",
+         cache.stats.hits, cache.stats.misses, cache.stats.evictions, cache.stats.writebacks);
+
+  // Allocator stress: random alloc/free with up to 128 live blocks of 32 B..8 KB.
+  // Bookkeeping is in MCU RAM, so this is timed on the host clock.
+  const uint32_t kHeapOps = 200000, kLive = 128;
+  static SRAMheap heap;
+  static uint32_t live_addr[kLive], live_size[kLive];
+  static uint8_t owner[SRAM_SIZE / SRAM_HEAP_ALIGN];
+  heap.Begin(0, SRAM_SIZE);
+  memset(live_addr, 0xFF, sizeof(live_addr));
+  memset(owner, 0, sizeof(owner));
+  uint64_t bump = 0;
+  uint32_t bump_allocs = 0;
+  bad = 0;
+  host::ResetStats();
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kHeapOps; i++) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t slot = (seed >> 8) % kLive;
+    if (live_addr[slot] != SRAM_ALLOC_FAIL) {
+      heap.Free(live_addr[slot]);
+      for (uint32_t u = 0; u < live_size[slot]; u += SRAM_HEAP_ALIGN) owner[(live_addr[slot] + u) / SRAM_HEAP_ALIGN] = 0;
+      live_addr[slot] = SRAM_ALLOC_FAIL;
+    } else {
+      uint32_t size = 32u << ((seed >> 16) % 9);
+      size -= (seed >> 4) % size / 2;
+      live_addr[slot] = heap.Alloc(size);
+      if (live_addr[slot] == SRAM_ALLOC_FAIL) continue;
+      live_size[slot] = size;
+      for (uint32_t u = 0; u < size; u += SRAM_HEAP_ALIGN) {
+        uint8_t &o = owner[(live_addr[slot] + u) / SRAM_HEAP_ALIGN];
+        bad += o != 0;                             // overlaps a live block
+        o = 1;
+      }
+      if (bump + size <= SRAM_SIZE) {
+        bump += size;
+        bump_allocs++;
+      }
+    }
+    if (i % 10000 == 0 && !heap.Check()) bad++;
+  }
+  double heap_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  bad += !heap.Check() + (host::Stats().spi_calls != 0);
+  SRAMHeapStats hs = heap.Stats();
+  printf("%-28s %6u ops, %.0f host ns/op, %u failures, bad %u\n", "SRAMheap stress", kHeapOps,
+         heap_ns / kHeapOps, hs.failures, bad);
+  printf("  heap: peak %u B, high water %u B, %u free fragments, fragmentation %u/1000; "
+         "bump allocator would have run out after %u of %u allocations\n",
+         hs.peak_used, hs.high_water, hs.free_blocks, hs.fragmentation, bump_allocs, hs.allocs + hs.failures);
+
+  // Per-frame scratch tensors: 32 allocations per frame, all dropped at the end
+  const uint32_t kFrames = 2000, kTensors = 32;
+  uint32_t tensors[kTensors];
+  bad = 0;
+  t0 = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < kFrames; f++) {
+    for (uint32_t i = 0; i < kTensors; i++) bad += (tensors[i] = sram.SRAMMalloc(256 + i * 64)) == SRAM_ALLOC_FAIL;
+    for (uint32_t i = 0; i < kTensors; i++) sram.SRAMFree(tensors[i]);
+  }
+  double malloc_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  printf("%-28s %6u allocs, %.1f host ns/alloc incl. free, bad %u\n", "scratch via SRAMMalloc",
+         kFrames * kTensors, malloc_ns / (kFrames * kTensors), bad);
+
+  SRAMarena arena;
+  bad = !arena.Begin(sram, 64 * 1024);
+  t0 = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < kFrames; f++) {
+    for (uint32_t i = 0; i < kTensors / 2; i++) bad += arena.Alloc(256 + i * 64) == SRAM_ALLOC_FAIL;
+    {
+      SRAMarenaScope scope(arena);              // nested scope for the second half
+      for (uint32_t i = kTensors / 2; i < kTensors; i++) bad += arena.Alloc(256 + i * 64) == SRAM_ALLOC_FAIL;
+    }
+    arena.Reset();
+  }
+  double arena_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  arena.End();
+  bad += sram.HeapStats().used_bytes != 0;
+  printf("%-28s %6u allocs, %.1f host ns/alloc incl. release, peak %u B, bad %u\n", "scratch via SRAMarena",
+         kFrames * kTensors, arena_ns / (kFrames * kTensors), arena.Peak(), bad);
+
+  char path[] = "/tmp/srambenchXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || write(fd, data, sizeof(data)) != (ssize_t)sizeof(data)) {
+    perror("model file");
+    return 1;
+  }
+  close(fd);
+  // The loader before pipelining: fread and a blocking write, strictly alternating
+  FILE *file = fopen(path, "r");
+  uint32_t offset = 0;
+  size_t got;
+  Begin();
+  while ((got = fread(back, 1, kBlock, file)) > 0) {
+    sram.SpiWriteByteArray(0x40000 + offset, back, got);
+    offset += got;
+  }
+  double serial_load = End("file load, read-then-write (ref)", 1, sizeof(data), Compare(0x40000, data, sizeof(data)));
+  fclose(file);
+
+  Begin();
+  sram.WriteFileInChunks(path);
+  End("WriteFileInChunks 64KB", 1, sizeof(data), Compare(sram.model_data.address, data, sizeof(data)));
+  printf("  loader: %u chunks in %u us (%u B/s), SD read %u us, SPI wait %u us, %.2fx the read-then-write loop\n",
+         sram.load_stats.chunks, sram.load_stats.total_us, sram.load_stats.bytes_per_s, sram.load_stats.read_us,
+         sram.load_stats.write_wait_us, serial_load / 1000.0 / sram.load_stats.total_us);
+  unlink(path);
+  uint8_t walk_check[512];
+
+  // Checking the load: reading it back by hand against Verify, then a flipped
+  // bit found by the block-wise scrub
+  const SRAMRegion model = sram.model_data;
+  bad = model.crc != SRAMsimple::Crc32(0, data, sizeof(data));
+  Begin();
+  uint32_t check_crc = 0;
+  for (uint32_t off = 0; off < model.size; off += sizeof(walk_check)) {
+    sram.SpiReadByteArray(model.address + off, sizeof(walk_check), walk_check);
+    check_crc = SRAMsimple::Crc32(check_crc, walk_check, sizeof(walk_check));
+  }
+  double hand_verify = End("verify 64KB, 512B reads", 1, model.size, bad + (check_crc != model.crc));
+  Begin();
+  double verify = End("Verify 64KB", 1, model.size, !sram.Verify(model));
+  auto crc_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 16; i++) check_crc = SRAMsimple::Crc32(check_crc, data, sizeof(data));
+  double crc_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - crc_start).count();
+
+  const uint32_t kFlip = 40000;
+  chip.Memory()[model.address + kFlip] ^= 0x10;
+  bad = sram.Verify(model);
+#if SRAM_LOADER_CRC
+  uint32_t scrub_calls = 0;
+  Begin();
+  while (sram.VerifySample() && scrub_calls < 100) scrub_calls++;
+  scrub_calls++;
+  bad += sram.scrub_stats.errors != 1 || sram.scrub_stats.bad_address != model.address + kFlip / SRAM_CRC_BLOCK * SRAM_CRC_BLOCK;
+  End("VerifySample, 4KB block", scrub_calls, scrub_calls * SRAM_CRC_BLOCK, bad);
+#endif
+  chip.Memory()[model.address + kFlip] ^= 0x10;
+#if SRAM_LOADER_CRC
+  printf("  CRC 0x%08X, Verify %.2fx the by-hand read-back, flip found after %u samples, Crc32 %.2f host ns/byte\n",
+         model.crc, hand_verify / verify, scrub_calls, crc_ns / 16 / sizeof(data));
+#else
+  printf("  CRC 0x%08X, Verify %.2fx the by-hand read-back, flip found by Verify: %s, no block CRCs, Crc32 %.2f host ns/byte\n",
+         model.crc, hand_verify / verify, bad ? "FAILED" : "ok", crc_ns / 16 / sizeof(data));
+#endif
+
+  // Walking the loaded model front to back, 60 us of work per 512-byte chunk
+  const uint32_t kWalkChunk = SRAM_READER_CHUNK;
+  const uint32_t kWalkChunks = sram.model_data.size / kWalkChunk;
+  const double kWalkNs = 60000;
+  uint8_t walk_buf[SRAM_READER_CHUNK];
+  Begin();
+  bad = 0;
+  for (uint32_t i = 0; i < kWalkChunks; i++) {
+    sram.SpiReadByteArray(sram.model_data.address + i * kWalkChunk, kWalkChunk, walk_buf);
+    bad += memcmp(walk_buf, data + i * kWalkChunk, kWalkChunk) != 0;
+    host::Compute(kWalkNs);
+  }
+  double chunked_walk = End("model walk, SpiReadByteArray", kWalkChunks, sram.model_data.size, bad);
+
+  SRAMreader reader(sram);
+  const uint8_t *chunk;
+  size_t got_chunk;
+  uint32_t walked = 0;
+  Begin();
+  bad = 0;
+  reader.Open(sram.model_data);
+  while ((got_chunk = reader.Next(&chunk)) > 0) {
+    bad += memcmp(chunk, data + walked, got_chunk) != 0;
+    walked += got_chunk;
+    host::Compute(kWalkNs);
+  }
+  reader.Close();
+  bad += walked != sram.model_data.size;
+  double stream_walk = End("model walk, SRAMreader", kWalkChunks, sram.model_data.size, bad);
+
+  // Odd-sized copies across chunk boundaries
+  Begin();
+  reader.Open(sram.model_data.address + 3, 10000);
+  for (walked = 0, bad = 0; (got = reader.Read(back, 777)) > 0; walked += got) {
+    bad += memcmp(back, data + 3 + walked, got) != 0;
+  }
+  bad += walked != 10000 || reader.Remaining() != 0;
+  reader.Close();
+  End("SRAMreader::Read 777B", (10000 + 776) / 777, 10000, bad);
+  printf("  streaming read speedup: %.2fx, HSREAD commands %llu\n", chunked_walk / stream_walk,
+         (unsigned long long)chip.Commands(SRAM23AA04M::kHsRead));
+
+  // Copies inside the chip: the by-hand loop through a 512-byte MCU buffer
+  // against SramCopy, then overlapping moves and a fill
+  const uint32_t kCopySrc = 0x50000, kCopyDst = 0x60000;
+  static uint8_t expect[0x10000 + 256];
+  uint8_t hop[512];
+  sram.SpiWriteByteArray(kCopySrc, data, sizeof(data));
+  memset(chip.Memory() + kCopyDst, 0, sizeof(data));
+  Begin();
+  for (uint32_t off = 0; off < sizeof(data); off += sizeof(hop)) {
+    sram.SpiReadByteArray(kCopySrc + off, sizeof(hop), hop);
+    sram.SpiWriteByteArray(kCopyDst + off, hop, sizeof(hop));
+  }
+  double hand_copy = End("copy 64KB, 512B MCU buffer", 1, sizeof(data), Compare(kCopyDst, data, sizeof(data)));
+  memset(chip.Memory() + kCopyDst, 0, sizeof(data));
+  Begin();
+  sram.SramCopy(kCopyDst, kCopySrc, sizeof(data));
+  double sram_copy = End("SramCopy 64KB", 1, sizeof(data), Compare(kCopyDst, data, sizeof(data)));
+
+  memcpy(expect, data, sizeof(data));
+  memmove(expect + 100, expect, sizeof(data) - 100);
+  Begin();
+  sram.SramMove(kCopySrc + 100, kCopySrc, sizeof(data) - 100);    // overlaps the source's end
+  bad = Compare(kCopySrc, expect, sizeof(data));
+  memmove(expect + 7, expect + 4000, 40000);
+  sram.SramMove(kCopySrc + 7, kCopySrc + 4000, 40000);            // overlaps its start
+  End("SramMove up 64KB, down 40KB", 2, sizeof(data) - 100 + 40000, bad + Compare(kCopySrc, expect, sizeof(data)));
+
+  memset(hop, 0x5A, sizeof(hop));
+  Begin();
+  for (uint32_t off = 0; off < sizeof(data); off += sizeof(hop)) sram.SpiWriteByteArray(kCopyDst + off, hop, sizeof(hop));
+  double hand_fill = End("fill 64KB, 512B MCU buffer", 1, sizeof(data), 0);
+  memset(expect, 0xC3, sizeof(data));
+  Begin();
+  sram.SramFill(kCopyDst + 1, 0xC3, sizeof(data) - 2);
+  bad = Compare(kCopyDst + 1, expect, sizeof(data) - 2);
+  bad += chip.Memory()[kCopyDst] != 0x5A || chip.Memory()[kCopyDst + sizeof(data) - 1] != 0x5A;
+  double sram_fill = End("SramFill 64KB", 1, sizeof(data) - 2, bad);
+  printf("  SramCopy %.2fx, SramFill %.2fx the by-hand loops\n", hand_copy / sram_copy, hand_fill / sram_fill);
+
+  // Shared access: two threads read 32-byte records while a third keeps
+  // loading 256 KB in 64 KB requests, first with the threads taking turns
+  // under a mutex, then through the scheduler's owner thread
+  const uint32_t kRecordBase = 0x20000, kBulkBase = 0x40000, kSharedRecords = 128, kSamples = 300;
+  sram.SpiWriteByteArray(kRecordBase, data, kSharedRecords * 32);
+  const char *shared_name[2] = {"shared, mutex", "shared, SRAMscheduler"};
+  double shared_p99[2];
+  for (int run = 0; run < 2; run++) {
+    std::mutex bus;
+    SRAMscheduler sched(sram);
+    if (run) sched.Start();
+    auto access = [&](bool write, uint32_t address, uint8_t *buf, size_t size, uint8_t priority) {
+      if (run) {
+        if (write) sched.Write(address, buf, size, priority);
+        else sched.Read(address, buf, size, priority);
+        return;
+      }
+      std::lock_guard<std::mutex> guard(bus);
+      if (write) sram.SpiWriteByteArray(address, buf, size);
+      else sram.SpiReadByteArray(address, size, buf);
+    };
+
+    std::vector<double> small_ns, bulk_ns;
+    std::mutex samples;
+    std::atomic<int> readers(2);
+    std::atomic<uint32_t> wrong(0);
+    Begin();
+    std::thread bulk([&] {
+      for (uint32_t i = 0; readers.load() > 0 || i < 4; i++) {
+        double t = host::Now();
+        access(true, kBulkBase + (i % 4) * 0x10000, data, 0x10000, SRAM_PRIO_BULK);
+        bulk_ns.push_back(host::Now() - t);
+      }
+    });
+    std::vector<std::thread> record_threads;
+    for (int r = 0; r < 2; r++) {
+      record_threads.emplace_back([&, r] {
+        uint8_t record[32];
+        for (uint32_t k = 0; k < kSamples; k++) {
+          uint32_t n = (k * 7 + r * 61) % kSharedRecords;
+          double t = host::Now(), took;
+          if (run) {                            // from Submit on, as the owner saw it
+            SRAMRequest req;
+            req.op = READ;
+            req.address = kRecordBase + n * 32;
+            req.data = record;
+            req.size = sizeof(record);
+            req.priority = SRAM_PRIO_LATENCY;
+            sched.Submit(req);
+            sched.Wait(req);
+            took = (req.done_us - req.queued_us) * 1000.0;
+          } else {
+            access(false, kRecordBase + n * 32, record, sizeof(record), SRAM_PRIO_LATENCY);
+            took = host::Now() - t;
+          }
+          wrong += memcmp(record, data + n * 32, sizeof(record)) != 0;
+          {
+            std::lock_guard<std::mutex> guard(samples);
+            small_ns.push_back(took);
+          }
+          usleep(50);
+        }
+        readers--;
+      });
+    }
+    for (auto &t : record_threads) t.join();
+    bulk.join();
+    sched.Stop();
+    bad = wrong;
+    for (uint32_t i = 0; i < 4; i++) bad += Compare(kBulkBase + i * 0x10000, data, 0x10000);
+    End(shared_name[run], small_ns.size() + bulk_ns.size(), small_ns.size() * 32 + bulk_ns.size() * 0x10000, bad);
+    shared_p99[run] = Percentile(small_ns, 0.99);
+    printf("  32B reads: p50 %.1f us, p99 %.1f us, max %.1f us; 64KB loads: p50 %.1f us, p99 %.1f us (%zu)\n",
+           Percentile(small_ns, 0.5), shared_p99[run], Percentile(small_ns, 1.0),
+           Percentile(bulk_ns, 0.5), Percentile(bulk_ns, 0.99), bulk_ns.size());
+  }
+  printf("  scheduler p99 small-read latency: %.2fx lower\n", shared_p99[0] / shared_p99[1]);
+  {
+    // A 64 KB latency request takes turns with a small read queued behind it
+    SRAMscheduler sched(sram);
+    sched.Start();
+    SRAMRequest large, small;
+    uint8_t record[32];
+    large.op = WRITE;
+    large.address = kBulkBase;
+    large.data = data;
+    large.size = 0x10000;
+    large.priority = SRAM_PRIO_LATENCY;
+    small.op = READ;
+    small.address = kRecordBase;
+    small.data = record;
+    small.size = sizeof(record);
+    small.priority = SRAM_PRIO_LATENCY;
+    sched.Submit(large);
+    sched.Submit(small);
+    sched.Wait(small);
+    sched.Wait(large);
+    sched.Stop();
+    uint32_t small_us = small.done_us - small.queued_us, large_us = large.done_us - large.queued_us;
+    bad = memcmp(record, data, sizeof(record)) != 0 || Compare(kBulkBase, data, 0x10000) || small_us * 4 > large_us ||
+          sched.Completed(SRAM_PRIO_LATENCY) != 2 || sched.Chunks() != 0x10000 / SRAM_SCHED_CHUNK;
+    printf("  32B read behind a 64KB latency write: %u us (the write %u us): %s\n", small_us, large_us,
+           bad ? "FAILED" : "ok");
+  }
+
+  // Eight files loaded one WriteFileInChunks call each, then as one batch,
+  // looked up by name and found again through the mirror after a "reset"
+  const int kFiles = 8;
+  char file_path[kFiles][32];
+  char file_name[kFiles][16];
+  const char *paths[kFiles], *names[kFiles];
+  uint32_t file_bytes = 0;
+  for (int f = 0; f < kFiles; f++) {
+    snprintf(file_path[f], sizeof(file_path[f]), "/tmp/srambenchXXXXXX");
+    snprintf(file_name[f], sizeof(file_name[f]), "tensor%d", f);
+    int fd = mkstemp(file_path[f]);
+    size_t length = 5000 + f * 1100;
+    if (fd < 0 || write(fd, data + f * 1000, length) != (ssize_t)length) {
+      perror("directory file");
+      return 1;
+    }
+    close(fd);
+    paths[f] = file_path[f];
+    names[f] = file_name[f];
+    file_bytes += length;
+  }
+  SRAMdirectory dir(sram);
+  const uint32_t kMirror = sram.Size() - SRAMdirectory::MirrorSize();   // as in the README
+  bad = !dir.Mirror(kMirror);
+  Begin();
+  for (int f = 0; f < kFiles; f++) {
+    sram.WriteFileInChunks(paths[f]);
+    bad += !dir.Add(names[f], sram.model_data);
+  }
+  double one_by_one = End("8 files, WriteFileInChunks", kFiles, file_bytes, bad);
+  for (int f = 0; f < kFiles; f++) bad += !dir.Remove(names[f]);
+  Begin();
+  bad += dir.LoadBatch(names, paths, kFiles) != kFiles;
+  for (int f = 0; f < kFiles; f++) {
+    const SRAMDirEntry *entry = dir.Find(names[f]);
+    bad += !entry || entry->region.size != 5000 + f * 1100u || Compare(entry->region.address, data + f * 1000, entry->region.size);
+  }
+  double batch = End("8 files, LoadBatch", kFiles, file_bytes, bad);
+  for (int f = 0; f < kFiles; f++) unlink(paths[f]);
+
+  bad = dir.Find("tensor9") != NULL || dir.Count() != kFiles;
+  auto find_start = std::chrono::steady_clock::now();
+  uint32_t found = 0;
+  for (int i = 0; i < 100000; i++) found += dir.Find(names[i % kFiles]) != NULL;
+  double find_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - find_start).count();
+  bad += found != 100000;
+  {
+    SRAMsimple rebooted(spi);                   // fresh heap, same chip contents
+    SRAMdirectory restored(rebooted);
+    Begin();
+    bad += !restored.Restore(kMirror) || restored.Count() != kFiles;
+    End("Restore directory", 1, SRAMdirectory::MirrorSize(), bad);
+    for (int f = 0; f < kFiles; f++) {
+      const SRAMDirEntry *entry = restored.Find(names[f]);
+      bad += !entry || !rebooted.Verify(entry->region);
+      bad += entry && rebooted.SRAMClaim(entry->region.address, 1) != SRAM_ALLOC_FAIL;   // in use again
+    }
+    bad += !restored.Remove(names[3]);          // the mirror follows
+    SRAMsimple rebooted_again(spi);
+    SRAMdirectory again(rebooted_again);
+    bad += !again.Restore(kMirror) || again.Count() != kFiles - 1 || again.Find(names[3]) != NULL;
+    for (uint8_t e = 0; e < SRAM_DIR_ENTRIES; e++) {   // a reset halfway through rewriting tensor5
+      const SRAMDirEntry *entry = again.Entry(e);
+      if (entry && strcmp(entry->name, names[5]) == 0) {
+        chip.Memory()[kMirror + 8 + e * (sizeof(SRAMDirEntry) + 4) + sizeof(SRAMDirEntry) - 1] ^= 0xFF;
+      }
+    }
+    SRAMsimple rebooted_torn(spi);
+    SRAMdirectory torn(rebooted_torn);
+    bad += !torn.Restore(kMirror) || torn.Count() != kFiles - 2 || torn.Find(names[5]) != NULL ||
+           torn.Find(names[4]) == NULL;
+    torn.Clear();
+    SRAMsimple rebooted_cleared(spi);
+    SRAMdirectory cleared(rebooted_cleared);
+    bad += !cleared.Restore(kMirror) || cleared.Count() != 0;
+  }
+  printf("  directory: batch load %.2fx one by one, Find %.1f host ns, restore after reset: %s\n",
+         one_by_one / batch, find_ns / 100000, bad ? "FAILED" : "ok");
+
+  // A 128x128 grid of words run through a 3-row stencil (rows pinned as
+  // plain pointers) and a transpose in 16x16 tiles (word by word), paged
+  // through 4, 8 and 16 frames of 1 KB, against the same loops doing one SPI
+  // transfer per word. A tile touches 16 pages.
+  const uint32_t kN = 128, kTile = 16, kGrid = kN * kN * 4;
+  static uint32_t grid[kN * kN], stencil[kN * kN], transposed[kN * kN];
+  for (uint32_t i = 0; i < kN * kN; i++) grid[i] = (i * 2654435761u) >> 8;
+  memset(stencil, 0, sizeof(stencil));
+  for (uint32_t r = 1; r + 1 < kN; r++) {
+    for (uint32_t c = 0; c < kN; c++) stencil[r * kN + c] = grid[(r - 1) * kN + c] + grid[r * kN + c] + grid[(r + 1) * kN + c];
+  }
+  for (uint32_t r = 0; r < kN; r++) {
+    for (uint32_t c = 0; c < kN; c++) transposed[c * kN + r] = stencil[r * kN + c];
+  }
+  const uint32_t kIn = 0, kOut = kGrid, kT = 2 * kGrid;
+  uint32_t direct_base = sram.SRAMMalloc(3 * kGrid);
+  sram.SpiWriteByteArray(direct_base + kIn, (const uint8_t *)grid, kGrid);
+  sram.SramFill(direct_base + kOut, 0, kGrid);
+  Begin();
+  for (uint32_t r = 1; r + 1 < kN; r++) {
+    for (uint32_t c = 0; c < kN; c++) {
+      uint32_t a, b, d, sum;
+      sram.SpiReadByteArray(direct_base + kIn + ((r - 1) * kN + c) * 4, 4, (uint8_t *)&a);
+      sram.SpiReadByteArray(direct_base + kIn + (r * kN + c) * 4, 4, (uint8_t *)&b);
+      sram.SpiReadByteArray(direct_base + kIn + ((r + 1) * kN + c) * 4, 4, (uint8_t *)&d);
+      sum = a + b + d;
+      sram.SpiWriteByteArray(direct_base + kOut + (r * kN + c) * 4, (const uint8_t *)&sum, 4);
+    }
+  }
+  for (uint32_t tile = 0; tile < kN * kN; tile += kTile * kTile) {
+    for (uint32_t i = 0; i < kTile * kTile; i++) {
+      uint32_t r = tile / (kTile * kN) * kTile + i / kTile, c = tile / kTile % kN + i % kTile, v;
+      sram.SpiReadByteArray(direct_base + kOut + (r * kN + c) * 4, 4, (uint8_t *)&v);
+      sram.SpiWriteByteArray(direct_base + kT + (c * kN + r) * 4, (const uint8_t *)&v, 4);
+    }
+  }
+  double direct_grid = End("grid, SPI per word", 2 * kN * kN, 2 * kGrid, Compare(direct_base + kT, (const uint8_t *)transposed, kGrid));
+  sram.SRAMFree(direct_base);
+
+  static SRAMpager pager;
+  const uint8_t pool[3] = {4, 8, 16};
+  double paged_grid[3];
+  for (int p = 0; p < 3; p++) {
+    bad = !pager.Begin(sram, 3 * kGrid, pool[p]);
+    pager.Write(kIn, (const uint8_t *)grid, kGrid);
+    for (uint32_t r = 0; r < kN; r += 2) {     // kOut is read by the transpose: clear the edge rows
+      uint32_t *row = (uint32_t *)pager.Pin(kOut + r * kN * 4, true);
+      memset(row, 0, 2 * kN * 4);
+      pager.Unpin(kOut + r * kN * 4);
+    }
+    pager.Flush();
+    pager.ResetStats();
+    Begin();
+    for (uint32_t r = 1; r + 1 < kN; r++) {
+      const uint32_t *above = (const uint32_t *)pager.Pin(kIn + (r - 1) * kN * 4);
+      const uint32_t *here = (const uint32_t *)pager.Pin(kIn + r * kN * 4);
+      const uint32_t *below = (const uint32_t *)pager.Pin(kIn + (r + 1) * kN * 4);
+      uint32_t *out = (uint32_t *)pager.Pin(kOut + r * kN * 4, true);
+      for (uint32_t c = 0; c < kN; c++) out[c] = above[c] + here[c] + below[c];
+      pager.Unpin(kIn + (r - 1) * kN * 4);
+      pager.Unpin(kIn + r * kN * 4);
+      pager.Unpin(kIn + (r + 1) * kN * 4);
+      pager.Unpin(kOut + r * kN * 4);
+    }
+    for (uint32_t tile = 0; tile < kN * kN; tile += kTile * kTile) {
+      for (uint32_t i = 0; i < kTile * kTile; i++) {
+        uint32_t r = tile / (kTile * kN) * kTile + i / kTile, c = tile / kTile % kN + i % kTile, v;
+        pager.Read(kOut + (r * kN + c) * 4, (uint8_t *)&v, 4);
+        pager.Write(kT + (c * kN + r) * 4, (const uint8_t *)&v, 4);
+      }
+    }
+    pager.Flush();
+    char name[40];
+    snprintf(name, sizeof(name), "grid, SRAMpager %u frames", pool[p]);
+    SRAMPagerStats run = pager.stats;
+    static uint32_t check[kN * kN];
+    pager.Read(kT, (uint8_t *)check, kGrid);
+    paged_grid[p] = End(name, 2 * kN * kN, 2 * kGrid, bad + (memcmp(check, transposed, kGrid) != 0));
+    printf("  %u frames: %u accesses, %u faults (%u.%u%%), %u us per fault, %u write-backs\n", pool[p], run.accesses,
+           run.faults, run.faults * 100 / run.accesses, run.faults * 1000 / run.accesses % 10,
+           run.faults ? run.fault_us / run.faults : 0, run.writebacks);
+    pager.End();
+  }
+  printf("  paging vs SPI per word: %.2fx (4 frames), %.2fx (8), %.2fx (16)\n", direct_grid / paged_grid[0],
+         direct_grid / paged_grid[1], direct_grid / paged_grid[2]);
+
+  // A 128 KB model file (pruned int8 weights and a repeated config table)
+  // stored raw and compressed, then streamed back. Decompression runs on the
+  // host CPU, which the cost model does not see, so the reader loop charges
+  // it as modeled CPU time: the measured host ns/byte times kMcuSlowdown.
+  const double kMcuSlowdown = 4.0;            // assumed M7 vs host for this byte loop
+  static uint8_t image[0x20000];
+  uint32_t image_seed = 7;
+  for (uint32_t i = 0; i < sizeof(image); i++) {
+    image_seed = image_seed * 1103515245 + 12345;
+    if (i % 0x4000 < 0x800) image[i] = "{\"layer\":12,\"scale\":0.0078125,\"zero\":-3}\n"[i % 41];
+    else image[i] = (image_seed >> 16) % 10 < 7 ? 0 : (uint8_t)((image_seed >> 8) % 9) - 4;
+  }
+  char model_path[] = "/tmp/srambenchXXXXXX";
+  fd = mkstemp(model_path);
+  if (fd < 0 || write(fd, image, sizeof(image)) != (ssize_t)sizeof(image)) {
+    perror("model file");
+    return 1;
+  }
+  close(fd);
+  bad = !sram.WriteFileInChunks(model_path);
+  SRAMRegion raw = sram.model_data;
+  SRAMRegion packed;
+  Begin();
+  bad += !SRAMlz::WriteFile(sram, model_path, &packed);
+  End("SRAMlz::WriteFile 128KB", 1, sizeof(image), bad + !sram.Verify(packed));
+  {
+    alignas(4) static uint8_t lz_work[SRAM_LZ_WORK];   // the same load with a work area of our own
+    SRAMRegion again;
+    bad = !SRAMlz::WriteFile(sram, model_path, &again, lz_work) || again.size != packed.size || again.crc != packed.crc;
+    sram.SRAMFree(again.address);
+    printf("  SRAMlz::WriteFile with a caller work area of %u bytes: %s\n", (unsigned)SRAM_LZ_WORK, bad ? "FAILED" : "ok");
+  }
+  unlink(model_path);
+
+  static uint8_t unpacked[SRAM_LZ_BLOCK];
+  auto unpack_start = std::chrono::steady_clock::now();
+  for (uint32_t off = 0; off < sizeof(image); off += SRAM_LZ_BLOCK) {
+    uint8_t block_buf[SRAM_LZ_BLOCK];
+    size_t n = SRAMlz::Compress(image + off, SRAM_LZ_BLOCK, block_buf, SRAM_LZ_BLOCK - 1);
+    for (int i = 0; i < 20; i++) SRAMlz::Decompress(block_buf, n, unpacked, SRAM_LZ_BLOCK);
+  }
+  double unpack_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - unpack_start).count()
+                     / 20 / sizeof(image);
+
+  SRAMreader raw_reader(sram);
+  Begin();
+  bad = 0;
+  walked = 0;
+  raw_reader.Open(raw);
+  while ((got_chunk = raw_reader.Next(&chunk)) > 0) {
+    bad += memcmp(chunk, image + walked, got_chunk) != 0;
+    walked += got_chunk;
+  }
+  raw_reader.Close();
+  double raw_read = End("128KB raw, SRAMreader", 1, sizeof(image), bad + (walked != sizeof(image)));
+
+  static SRAMlzreader lz_reader(sram);
+  Begin();
+  bad = !lz_reader.Open(packed) || lz_reader.Size() != sizeof(image);
+  walked = 0;
+  while ((got_chunk = lz_reader.Next(&chunk)) > 0) {
+    host::Compute(got_chunk * unpack_ns * kMcuSlowdown);
+    bad += memcmp(chunk, image + walked, got_chunk) != 0;
+    walked += got_chunk;
+  }
+  double packed_read = End("128KB packed, SRAMlzreader", 1, sizeof(image), bad + (walked != sizeof(image)));
+
+  bad = 0;
+  for (uint32_t i = 0; i < 200; i++) {                 // random access
+    uint32_t at = (i * 7919u * 13u) % (sizeof(image) - 100);
+    uint8_t piece[100];
+    bad += !lz_reader.Seek(at) || lz_reader.Read(piece, sizeof(piece)) != sizeof(piece) ||
+           memcmp(piece, image + at, sizeof(piece)) != 0;
+  }
+  lz_reader.Close();
+  uint32_t index_at = packed.address + packed.size - sizeof(SRAMLzTrailer) - 4 * 3;   // entry blocks - 2
+  uint32_t entry = sram.ReadWord(index_at);
+  sram.WriteWord(index_at, entry + 2 * SRAM_LZ_BLOCK);   // stale index: a block larger than _packed
+  bad += lz_reader.Open(packed);
+  sram.WriteWord(index_at, entry);
+  bad += !lz_reader.Open(packed);
+  lz_reader.Close();
+  sram.SRAMFree(packed.address);
+  sram.SRAMFree(raw.address);
+  printf("  compressed: %u -> %u bytes (%.2fx), effective capacity %u KB, read %.2fx the raw path "
+         "(decode %.2f host ns/byte), random reads: %s\n", (unsigned)sizeof(image), packed.size,
+         (double)sizeof(image) / packed.size, (unsigned)((uint64_t)SRAM_SIZE * sizeof(image) / packed.size / 1024),
+         raw_read / packed_read, unpack_ns, bad ? "FAILED" : "ok");
+
+  // Sensor records streamed through a 64 KB ring: 96 KB pushed per record
+  // size, drained 1 KB at a time after every 8 KB. By hand, each record is
+  // its own SpiWriteByteArray; SRAMring stages them and flushes whole pages.
+  const uint32_t kRingBytes = 0x10000, kStream = 0x18000, kDrain = 0x2000;
+  const uint32_t record_size[4] = {4, 16, 64, 256};
+  static SRAMring ring;
+  uint8_t record[256], drained[1024];
+  for (int k = 0; k < 4; k++) {
+    uint32_t size = record_size[k];
+    double ring_ns[2];
+    for (int use_ring = 0; use_ring < 2; use_ring++) {
+      uint32_t ring_base = 0;
+      if (use_ring) bad = !ring.Begin(sram, kRingBytes);
+      else bad = (ring_base = sram.SRAMMalloc(kRingBytes)) == SRAM_ALLOC_FAIL;
+      uint32_t pushed = 0, popped = 0;
+      Begin();
+      while (pushed < kStream) {
+        for (uint32_t i = 0; i < size; i++) record[i] = (uint8_t)((pushed + i) * 31 + 7);
+        if (use_ring) {
+          while (!ring.Push(record, size)) ring.Flush();
+        } else {
+          uint32_t at = pushed % kRingBytes;
+          uint32_t first = kRingBytes - at < size ? kRingBytes - at : size;
+          sram.SpiWriteByteArray(ring_base + at, record, first);
+          if (first < size) sram.SpiWriteByteArray(ring_base, record + first, size - first);
+        }
+        pushed += size;
+        if (pushed % kDrain != 0) continue;
+        for (uint32_t d = 0; d < kDrain; d += sizeof(drained)) {
+          if (use_ring) {
+            bad += !ring.Pop(drained, sizeof(drained));
+          } else {
+            sram.SpiReadByteArray(ring_base + popped % kRingBytes, sizeof(drained), drained);
+          }
+          for (uint32_t i = 0; i < sizeof(drained); i++) bad += drained[i] != (uint8_t)((popped + i) * 31 + 7);
+          popped += sizeof(drained);
+        }
+      }
+      char name[40];
+      snprintf(name, sizeof(name), "ring %uB records, %s", size, use_ring ? "SRAMring" : "by hand");
+      ring_ns[use_ring] = End(name, kStream / size, kStream, bad);
+      if (use_ring) {
+        printf("  %u records, %u bursts, %u pushes refused with staging full (flushed and retried)\n", ring.stats.pushed, ring.stats.bursts, ring.stats.dropped);
+        ring.End();
+      } else {
+        sram.SRAMFree(ring_base);
+      }
+    }
+    printf("  %uB records: SRAMring %.2fx the per-record writes\n", size, ring_ns[0] / ring_ns[1]);
+  }
+
+  // Chip-select backends on back-to-back word commands, where CS framing is
+  // a large part of each transaction, and on 4 KB blocks. The hardware NSS
+  // run uses a second SPI object with the chip's CS as ssel. sram caches the
+  // frame width of the shared SPI, so both are left on 32-bit frames.
+  {
+    SPI spi_nss(PC_3, PC_2, PI_1, PI_0);
+    const char *cs_name[4] = {"digitalWrite", "DigitalOut", "GPIO BSRR", "hardware NSS"};
+    double cs_word[4], cs_overhead[4];
+    sram.ReadWord(0);
+    for (uint8_t mode = SRAM_CS_DIGITALWRITE; mode <= SRAM_CS_HARDWARE; mode++) {
+      SRAMsimple cs_sram(mode == SRAM_CS_HARDWARE ? spi_nss : spi, mode);
+      char name[40];
+      cs_sram.SetMode(Sequential);
+      Begin();
+      bad = 0;
+      for (uint32_t i = 0; i < kWords; i++) cs_sram.WriteWord(0x40000 + i * 4, 0x5A000000u + i);
+      for (uint32_t i = 0; i < kWords; i++) bad += cs_sram.ReadWord(0x40000 + i * 4) != 0x5A000000u + i;
+      snprintf(name, sizeof(name), "CS %s, words", cs_name[mode]);
+      cs_word[mode] = End(name, 2 * kWords, 8 * kWords, bad);
+      cs_overhead[mode] = host::Stats().overhead_ns / (2 * kWords);
+      uint32_t gpio = (uint32_t)host::Stats().gpio_writes;
+
+      Begin();
+      cs_sram.SpiWriteByteArray(0x40000, data, 4096);
+      cs_sram.SpiReadByteArray(0x40000, 4096, back);
+      snprintf(name, sizeof(name), "CS %s, 4KB blocks", cs_name[mode]);
+      End(name, 2, 8192, Compare(0x40000, data, 4096) + (memcmp(back, data, 4096) != 0));
+      printf("  %s: %.0f ns driver and CS overhead per word command, %.1f GPIO writes each\n",
+             cs_name[mode], cs_overhead[mode], (double)gpio / (2 * kWords));
+      cs_sram.ReadWord(0);
+    }
+    printf("  per word command vs digitalWrite: DigitalOut %.2fx, GPIO BSRR %.2fx, hardware NSS %.2fx\n",
+           cs_word[0] / cs_word[1], cs_word[0] / cs_word[2], cs_word[0] / cs_word[3]);
+  }
+
+  // Warm boot: four 64 KB files loaded as a batch (the cold boot), saved as a
+  // snapshot, touched in two places and saved again incrementally, then
+  // restored into a fresh SRAMsimple after the chip lost its contents
+  {
+    const int kWarmFiles = 4;
+    char warm_path[kWarmFiles][32];
+    const char *warm_paths[kWarmFiles];
+    SRAMRegion warm_regions[kWarmFiles];
+    for (int f = 0; f < kWarmFiles; f++) {
+      snprintf(warm_path[f], sizeof(warm_path[f]), "/tmp/srambenchXXXXXX");
+      int fd = mkstemp(warm_path[f]);
+      if (fd < 0 || write(fd, data, sizeof(data)) != (ssize_t)sizeof(data)) {
+        perror("snapshot file");
+        return 1;
+      }
+      close(fd);
+      warm_paths[f] = warm_path[f];
+    }
+    char snap_path[] = "/tmp/srambenchXXXXXX";
+    int snap_fd = mkstemp(snap_path);
+    if (snap_fd < 0) {
+      perror("snapshot");
+      return 1;
+    }
+    close(snap_fd);
+
+    sram.ReadWord(0);                           // see the CS backends above
+    SRAMsimple warm(spi);
+    Begin();
+    bad = warm.WriteFilesInChunks(warm_paths, warm_regions, kWarmFiles) != kWarmFiles;
+    double cold_ns = End("cold boot, 4 x 64KB files", kWarmFiles, kWarmFiles * sizeof(data), bad);
+
+    Begin();
+    bad = !warm.SaveSnapshot(snap_path);
+    double full_ns = End("SaveSnapshot, full", 1, warm.snapshot_stats.bytes, bad);
+    printf("  %u bursts, SD %u us, SPI wait %u us\n", warm.snapshot_stats.bursts,
+           warm.snapshot_stats.sd_us, warm.snapshot_stats.spi_wait_us);
+    uint32_t full_bytes = warm.snapshot_stats.bytes;
+
+    warm.WriteWord(warm_regions[0].address + 100, 0xDEADBEEF);
+    warm.SramFill(warm_regions[2].address + 0x2000, 0x5A, 512);
+    Begin();
+    bad = !warm.SaveSnapshot(snap_path, true);
+    double incremental_ns = End("SaveSnapshot, incremental", 1, warm.snapshot_stats.bytes, bad);
+    uint32_t incremental_bytes = warm.snapshot_stats.bytes;
+
+    SRAMHeapStats heap_before = warm.HeapStats();
+    std::vector<uint8_t> expect(chip.Memory(), chip.Memory() + heap_before.high_water);
+    warm.ReadWord(0);
+    memset(chip.Memory(), 0, SRAM23AA04M::kSize);   // power lost
+    SRAMsimple booted(spi);
+    Begin();
+    bad = !booted.LoadSnapshot(snap_path);
+    bad += memcmp(chip.Memory(), expect.data(), expect.size()) != 0;
+    double boot_ns = End("LoadSnapshot (warm boot)", 1, booted.snapshot_stats.bytes, bad);
+    bad += booted.model_data.address != warm.model_data.address || !booted.Verify(booted.model_data);
+    bad += !booted.Verify(warm_regions[1]) || !booted.VerifySample(SRAM_CRC_BLOCKS);
+    bad += booted.HeapStats().used_bytes != heap_before.used_bytes;
+    bad += booted.SRAMClaim(warm_regions[3].address, 1) != SRAM_ALLOC_FAIL;   // still allocated
+    booted.WriteWord(warm_regions[1].address, 0x600DB007);
+    bad += !booted.SaveSnapshot(snap_path, true) || booted.snapshot_stats.bytes != SRAM_SNAP_PAGE;   // follows the loaded one
+    printf("  warm boot %.2fx the cold load; incremental save %.2fx the full one (%u of %u KB); restore: %s\n",
+           cold_ns / boot_ns, full_ns / incremental_ns, incremental_bytes / 1024, full_bytes / 1024,
+           bad ? "FAILED" : "ok");
+    booted.ReadWord(0);
+    for (int f = 0; f < kWarmFiles; f++) unlink(warm_paths[f]);
+    unlink(snap_path);
+  }
+
+  // The built-in counters over a mixed workload, checked against what the bus
+  // model saw. On the host the histograms run on std::chrono, so they show
+  // host time, not modeled time.
+#if SRAM_STATS
+  {
+    sram.ResetStats();
+    host::ResetStats();
+    uint32_t base = 0x60000;
+    bad = 0;
+    for (uint32_t i = 0; i < kWords; i++) sram.WriteWord(base + i * 4, i);
+    for (uint32_t i = 0; i < kWords; i++) bad += sram.ReadWord(base + i * 4) != i;
+    for (uint32_t i = 0; i < 64; i++) sram.SpiWriteByteArray(base + i * 256, data + i * 256, 256);
+    for (uint32_t i = 0; i < 64; i++) sram.SpiReadByteArray(base + i * 256, 256, back + i * 256);
+    bad += memcmp(back, data, 64 * 256) != 0;
+    for (uint32_t i = 0; i < 16; i++) sram.AsyncWait(sram.ReadAsync(base + i * 4096, back, 4096));
+    sram.SetMode(ByteMode);
+    sram.WriteWord(base, 0);                    // back to sequential
+    bad += sram.SRAMMalloc(sram.Size() * 2) != SRAM_ALLOC_FAIL;
+    host::WaitBus();
+
+    SRAMStats stats = sram.GetStats();
+    const char *op_name[SRAM_STAT_OPS] = {"word read", "word write", "read", "write", "async read", "async write"};
+    const uint32_t op_bytes[SRAM_STAT_OPS] = {kWords * 4, (kWords + 1) * 4, 64 * 256, 64 * 256, 16 * 4096, 0};
+    for (int op = 0; op < SRAM_STAT_OPS; op++) {
+      bad += stats.op[op].bytes != op_bytes[op];
+      if (stats.op[op].count == 0) continue;
+      printf("  stats %-11s %5u ops %8llu bytes, latency p50 < %.1f us, p99 < %.1f us (host)\n", op_name[op],
+             stats.op[op].count, (unsigned long long)stats.op[op].bytes,
+             BucketPercentile(stats.op[op], stats.clock_hz, 0.5), BucketPercentile(stats.op[op], stats.clock_hz, 0.99));
+    }
+    bad += stats.transactions != host::Stats().cs_low || stats.mode_switches != 2 || stats.alloc_failures != 1;
+    printf("  stats: %u transactions (bus model %llu), %u mode switches, %u failed allocations: %s\n",
+           stats.transactions, (unsigned long long)host::Stats().cs_low, stats.mode_switches, stats.alloc_failures,
+           bad ? "FAILED" : "ok");
+  }
+#endif
+
+  // Two chips as one 1 MB space, with a 64 KB block across the chip boundary
+  host::Attach(kCsPinB, &chip_b);
+  const uint32_t pins[2] = {kCsPin, kCsPinB};
+  const char *layout_name[2] = {"concat", "stripe"};
+  for (uint8_t layout = SRAM_CONCAT; layout <= SRAM_STRIPE; layout++) {
+    SRAMsimple pair(spi, pins, 2, layout);
+    const uint32_t base = SRAM_SIZE - 0x8000;
+    char name[40];
+    pair.SetMode(Sequential);
+    memset(chip.Memory(), 0, SRAM23AA04M::kSize);
+    memset(chip_b.Memory(), 0, SRAM23AA04M::kSize);
+
+    Begin();
+    pair.SpiWriteByteArray(base, data, sizeof(data));
+    bad = chip_b.Errors();
+    for (uint32_t i = 0; i < sizeof(data); i++) bad += PairByte(layout, base + i) != data[i];
+    snprintf(name, sizeof(name), "2 chips %s, write 64KB", layout_name[layout]);
+    End(name, 1, sizeof(data), bad);
+
+    memset(back, 0, sizeof(back));
+    Begin();
+    pair.SpiReadByteArray(base, sizeof(back), back);
+    snprintf(name, sizeof(name), "2 chips %s, read 64KB", layout_name[layout]);
+    End(name, 1, sizeof(back), memcmp(back, data, sizeof(data)) != 0);
+
+    memset(back, 0, sizeof(back));
+    Begin();
+    uint32_t handle = pair.ReadAsync(base, back, sizeof(back));
+    pair.AsyncWait(handle);
+    host::WaitBus();
+    snprintf(name, sizeof(name), "2 chips %s, ReadAsync 64KB", layout_name[layout]);
+    End(name, 1, sizeof(back), memcmp(back, data, sizeof(data)) != 0);
+
+    SRAMreader pair_reader(pair);
+    Begin();
+    pair_reader.Open(base, sizeof(back));
+    bad = pair_reader.Read(back, sizeof(back)) != sizeof(back);
+    pair_reader.Close();
+    snprintf(name, sizeof(name), "2 chips %s, SRAMreader 64KB", layout_name[layout]);
+    End(name, 1, sizeof(back), bad + (memcmp(back, data, sizeof(data)) != 0));
+
+    pair.WriteWord(SRAM_SIZE - 2, 0x12345678);   // straddles the chip boundary with concat
+    bad = pair.ReadWord(SRAM_SIZE - 2) != 0x12345678 || pair.Size() != 2 * SRAM_SIZE;
+    bad += pair.SRAMMalloc(SRAM_SIZE + SRAM_SIZE / 2) == SRAM_ALLOC_FAIL;
+    bad += chip.Errors() + chip_b.Errors();
+    printf("  %s: straddling word, 768 KB allocation: %s\n", layout_name[layout], bad ? "FAILED" : "ok");
+  }
+
+  // The first chip again, switched to SQI on the QSPI peripheral (ssel = its CS pin)
+  QSPI qspi(PD_11, PD_12, PE_2, PD_13, PB_2, PI_0);
+  SRAMsimple quad(qspi);
+  quad.SetMode(Sequential);
+  bad = !chip.Quad();
+  printf("  SQI mode entered: %s\n", bad ? "FAILED" : "ok");
+
+  memset(chip.Memory(), 0, kBlocks * kBlock);
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) quad.SpiWriteByteArray(i * kBlock, data + i * kBlock, kBlock);
+  double quad_write = End("SQI SpiWriteByteArray 3200B", kBlocks, kBlocks * kBlock, Compare(0, data, kBlocks * kBlock));
+
+  memset(back, 0, sizeof(back));
+  Begin();
+  for (uint32_t i = 0; i < kBlocks; i++) quad.SpiReadByteArray(i * kBlock, kBlock, back + i * kBlock);
+  double quad_read = End("SQI SpiReadByteArray 3200B", kBlocks, kBlocks * kBlock,
+                         memcmp(back, data, kBlocks * kBlock) != 0);
+
+  Begin();
+  bad = 0;
+  for (uint32_t i = 0; i < kWords; i++) quad.WriteWord(0x30000 + i * 4, 0xC3000000u + i);
+  for (uint32_t i = 0; i < kWords; i++) bad += quad.ReadWord(0x30000 + i * 4) != 0xC3000000u + i;
+  End("SQI WriteWord+ReadWord", 2 * kWords, 8 * kWords, bad);
+
+  // WRSR/RDSR right after a read, while the format still has the read's dummy cycles
+  bad = chip.Errors();
+  quad.ReadWord(0x30000);
+  quad.SetMode(PageMode);
+  bad += chip.Status() != SRAM23AA04M::kPageMode;
+  quad.ReadWord(0x30000);
+  bad += quad.ReadMode() != SRAM23AA04M::kPageMode;
+  quad.SetMode(Sequential);
+  bad += chip.Status() != SRAM23AA04M::kSeqMode || chip.Errors();
+  printf("  SQI status commands after a read: %s\n", bad ? "FAILED" : "ok");
+
+  SRAMreader quad_reader(quad);
+  Begin();
+  bad = 0;
+  walked = 0;
+  quad_reader.Open(0, kBlocks * kBlock);
+  while ((got_chunk = quad_reader.Next(&chunk)) > 0) {
+    bad += memcmp(chunk, data + walked, got_chunk) != 0;
+    walked += got_chunk;
+    host::Compute(kWalkNs);
+  }
+  quad_reader.Close();
+  End("SQI model walk, SRAMreader", (kBlocks * kBlock + kWalkChunk - 1) / kWalkChunk, kBlocks * kBlock,
+      bad + (walked != kBlocks * kBlock));
+  printf("  SQI vs SPI block transfer: write %.2fx, read %.2fx\n", block_write / quad_write, block_read / quad_read);
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*  Arduino.h - Host stand-in for the Arduino core calls used by SRAMsimple.
+ *  digitalWrite drives the chip selects of the emulated bus in HostBus.h,
+ *  and Serial output is counted (and charged at the configured baud rate)
+ *  rather than printed unless SRAM_HOST_SERIAL is set in the environment.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define DEC     10
+#define HEX     16
+
+void pinMode(uint32_t pin, int mode);
+void digitalWrite(uint32_t pin, int value);
+int digitalRead(uint32_t pin);
+unsigned long micros();
+unsigned long millis();
+void yield();
+
+class HostSerial {
+  public:
+    void begin(unsigned long baud);
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(double n, int digits = 2);
+    size_t println();
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int fmt) { size_t n = print(value, fmt); return n + println(); }
+    operator bool() { return true; }
+
+  private:
+    size_t Emit(const char *s, size_t len);
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,80 @@
+/*  HostArduino.cpp - Host implementation of the Arduino core stand-in.
+ */
+
+#include "Arduino.h"
+#include "HostBus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+HostSerial Serial;
+
+void pinMode(uint32_t pin, int mode) {
+  (void)pin; (void)mode;
+}
+
+void digitalWrite(uint32_t pin, int value) {
+  host::PinWrite(pin, value);
+}
+
+int digitalRead(uint32_t pin) {
+  return host::PinRead(pin);
+}
+
+unsigned long micros() {
+  return (unsigned long)(host::Now() / 1000.0);
+}
+
+unsigned long millis() {
+  return (unsigned long)(host::Now() / 1000000.0);
+}
+
+// Only called from wait loops: let the modeled CPU sleep until the next
+// completion interrupt
+void yield() {
+  host::Idle();
+  std::this_thread::yield();
+}
+
+void HostSerial::begin(unsigned long baud) {
+  host::Cost().serial_baud = (double)baud;
+}
+
+size_t HostSerial::Emit(const char *s, size_t len) {
+  static int echo = -1;
+  if (echo < 0) echo = getenv("SRAM_HOST_SERIAL") != NULL;
+  if (echo) fwrite(s, 1, len, stdout);
+  host::ChargeSerial(len);
+  return len;
+}
+
+size_t HostSerial::print(const char *s) {
+  return Emit(s, strlen(s));
+}
+
+size_t HostSerial::print(char c) {
+  return Emit(&c, 1);
+}
+
+size_t HostSerial::print(unsigned long n, int base) {
+  char buf[40];
+  int len = snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+  return Emit(buf, len);
+}
+
+size_t HostSerial::print(long n, int base) {
+  if (base != DEC) return print((unsigned long)n, base);
+  char buf[40];
+  int len = snprintf(buf, sizeof(buf), "%ld", n);
+  return Emit(buf, len);
+}
+
+size_t HostSerial::print(double n, int digits) {
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return Emit(buf, len);
+}
+
+size_t HostSerial::println() {
+  return Emit("\r\n", 2);
+}
@@ -0,0 +1,182 @@
+/*  HostBus.cpp - Emulated SPI bus for building SRAMsimple on a Linux host.
+ */
+
+#include "HostBus.h"
+#include <string.h>
+#include <mutex>
+
+namespace host {
+
+namespace {
+
+const int kMaxPins = 16;
+
+struct PinSlot {
+  uint32_t pin;
+  int level;
+  BusDevice *dev;
+};
+
+PinSlot pins[kMaxPins];
+int pin_count = 0;
+BusStats stats;
+double clock_ns = 0;
+double dma_done_ns = 0;
+double irq_ns = -1;
+std::recursive_mutex bus_lock;
+CostModel cost = { 400.0, 20.0, 300.0, 25.0, 10.0, 115200.0, 100000.0, 80.0 };
+
+PinSlot *FindPin(uint32_t pin, bool create) {
+  for (int i = 0; i < pin_count; i++) {
+    if (pins[i].pin == pin) return &pins[i];
+  }
+  if (!create || pin_count == kMaxPins) return NULL;
+  PinSlot *slot = &pins[pin_count++];
+  slot->pin = pin;
+  slot->level = 1;                    // chip selects idle high (pull-up)
+  slot->dev = NULL;
+  return slot;
+}
+
+}
+
+void Attach(uint32_t pin, BusDevice *dev) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  PinSlot *slot = FindPin(pin, true);
+  if (slot) slot->dev = dev;
+}
+
+void DetachAll() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  pin_count = 0;
+}
+
+void PinWrite(uint32_t pin, int value) {
+  GpioWrite(pin, value, cost.digital_write_ns);
+}
+
+void GpioWrite(uint32_t pin, int value, double cost_ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  stats.gpio_writes++;
+  ChargeOverhead(cost_ns);
+  HardwareSelect(pin, value);
+}
+
+void HardwareSelect(uint32_t pin, int value) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  PinSlot *slot = FindPin(pin, true);
+  if (!slot) return;
+  int level = value ? 1 : 0;
+  if (slot->dev && level != slot->level) {
+    if (level == 0) {
+      stats.cs_low++;
+      slot->dev->Select();
+    } else {
+      slot->dev->Deselect();
+    }
+  }
+  slot->level = level;
+}
+
+int PinRead(uint32_t pin) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  PinSlot *slot = FindPin(pin, false);
+  return slot ? slot->level : 0;
+}
+
+// Shift one byte to every selected device; MISO is wired-OR of their outputs
+uint8_t Transfer(uint8_t mosi, int lanes) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  uint8_t miso = 0;
+  for (int i = 0; i < pin_count; i++) {
+    if (pins[i].dev && pins[i].level == 0) miso |= pins[i].dev->Transfer(mosi, lanes);
+  }
+  stats.bytes++;
+  return miso;
+}
+
+void ChargeWire(double ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  stats.wire_ns += ns;
+  clock_ns += ns;
+}
+
+void ChargeOverhead(double ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  stats.overhead_ns += ns;
+  clock_ns += ns;
+}
+
+void ChargeSerial(size_t chars) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  double ns = chars * 10.0 * 1e9 / cost.serial_baud;   // start + 8 data + stop bits
+  stats.serial_chars += chars;
+  stats.serial_ns += ns;
+  clock_ns += ns;
+}
+
+void ChargeSd(size_t bytes) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  double ns = cost.sd_call_ns + bytes * cost.sd_byte_ns;
+  stats.sd_ns += ns;
+  clock_ns += ns;
+}
+
+// A DMA transfer starts once it has been issued and the previous one has finished
+double ChargeDma(double start_ns, double wire_ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  dma_done_ns = (dma_done_ns > start_ns ? dma_done_ns : start_ns) + wire_ns;
+  stats.wire_ns += wire_ns;
+  return dma_done_ns;
+}
+
+void Compute(double ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  clock_ns += ns;
+}
+
+void WaitBus() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  if (dma_done_ns > clock_ns) {
+    stats.wait_ns += dma_done_ns - clock_ns;
+    clock_ns = dma_done_ns;
+  }
+}
+
+void RaiseAt(double ns) {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  irq_ns = ns;
+}
+
+void ClearIrq() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  irq_ns = -1;
+}
+
+void Idle() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  if (irq_ns > clock_ns) {
+    stats.wait_ns += irq_ns - clock_ns;
+    clock_ns = irq_ns;
+  }
+}
+
+double Now() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  return clock_ns;
+}
+
+BusStats &Stats() {
+  return stats;
+}
+
+void ResetStats() {
+  std::lock_guard<std::recursive_mutex> guard(bus_lock);
+  memset(&stats, 0, sizeof(stats));
+}
+
+CostModel &Cost() {
+  return cost;
+}
+
+}
@@ -0,0 +1,83 @@
+/*  HostBus.h - Emulated SPI bus for building SRAMsimple on a Linux host.
+ *  Chip-select pins driven through digitalWrite() select the attached
+ *  BusDevice, and every transfer is counted and charged against a simple
+ *  cost model so transaction counts and bus time can be compared between
+ *  changes without a board.
+ *  DMA transfers run on their own timeline, so CPU work issued while one is
+ *  in flight overlaps it; their completions are delivered once the CPU clock
+ *  reaches them, and a CPU waiting in yield() skips ahead to the next one. All entry points are safe to call from the thread
+ *  that emulates transfer completion.
+ */
+
+#ifndef HostBus_h
+#define HostBus_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace host {
+
+// A device on the emulated bus, selected through a GPIO chip-select pin
+class BusDevice {
+  public:
+    virtual ~BusDevice() {}
+    virtual void Select() = 0;
+    virtual void Deselect() = 0;
+    virtual uint8_t Transfer(uint8_t mosi, int lanes) = 0;   // one byte over 1, 2 or 4 data lanes
+};
+
+struct BusStats {
+  uint64_t spi_calls;       // driver round trips (SPI::write, SPI::format, ...)
+  uint64_t frames;          // SPI frames clocked, of the configured width
+  uint64_t bytes;           // bytes shifted on the bus
+  uint64_t cs_low;          // chip-select falling edges, i.e. transactions
+  uint64_t gpio_writes;     // chip-select pin changes made by the CPU
+  uint64_t serial_chars;    // characters printed through Serial
+  uint64_t critical_calls;  // blocking SPI calls made with interrupts masked, fatal on mbed
+  double wire_ns;           // time the clock line was running
+  double overhead_ns;       // driver and GPIO overhead between frames
+  double serial_ns;         // time blocked in Serial output
+  double wait_ns;           // time the CPU sat idle waiting for DMA transfers
+  double sd_ns;             // time blocked reading files
+};
+
+// Modeled costs in nanoseconds. The defaults are rough figures for mbed OS on
+// the Portenta H7 (480 MHz M7); only their relative size matters for comparisons.
+struct CostModel {
+  double spi_call_ns;       // SPI::write(int) / format() call: lock, acquire, HAL setup
+  double spi_block_byte_ns; // per element of a buffered SPI::write in the HAL loop
+  double digital_write_ns;  // Arduino digitalWrite: pin lookup and gpio_write
+  double digital_out_ns;    // mbed DigitalOut::write: gpio_write through the object
+  double gpio_register_ns;  // one store to a GPIO port register (BSRR)
+  double serial_baud;       // Serial line rate used to charge print calls
+  double sd_call_ns;        // fread from the SD card: command and FAT latency
+  double sd_byte_ns;        // fread from the SD card, per byte
+};
+
+void Attach(uint32_t pin, BusDevice *dev);
+void DetachAll();
+void PinWrite(uint32_t pin, int value);
+void GpioWrite(uint32_t pin, int value, double cost_ns);   // a pin change charged at cost_ns
+void HardwareSelect(uint32_t pin, int value);   // chip select driven by a peripheral, no GPIO cost
+int PinRead(uint32_t pin);
+uint8_t Transfer(uint8_t mosi, int lanes);
+
+void ChargeWire(double ns);
+void ChargeOverhead(double ns);
+void ChargeSerial(size_t chars);
+void ChargeSd(size_t bytes);
+double ChargeDma(double start_ns, double wire_ns);   // wire time on the DMA timeline, returns its end
+void Compute(double ns);              // application work on the CPU timeline
+void WaitBus();                       // idle the CPU until queued DMA time has elapsed
+void RaiseAt(double ns);              // a completion interrupt is due at this time
+void ClearIrq();
+void Idle();                          // idle the CPU until the pending interrupt, if any
+double Now();                         // modeled nanoseconds since start
+
+BusStats &Stats();
+void ResetStats();
+CostModel &Cost();
+
+}
+
+#endif
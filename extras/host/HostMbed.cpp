@@ -0,0 +1,393 @@
+/*  HostMbed.cpp - Host implementation of the mbed::SPI, mbed::QSPI and rtos stand-ins.
+ *  SPI frames are shifted MSB first through host::Transfer on a single data
+ *  lane; QSPI commands pass each phase with its configured lane count.
+ */
+
+#include "mbed.h"
+#include "HostBus.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Held by critical sections and by the completion thread while it runs a
+// callback, so callbacks see the same exclusion an interrupt handler would
+std::recursive_mutex irq_lock;
+
+// Critical sections entered by this thread, to catch blocking SPI calls
+// made with interrupts masked
+thread_local int critical_depth = 0;
+
+// Modeled time of the completion being handled, while the completion thread
+// runs a callback; transfers started from there are issued at that instant
+thread_local double irq_time_ns = -1;
+
+struct DmaJob {
+  const uint8_t *tx;
+  int tx_length;
+  uint8_t *rx;
+  int rx_length;
+  char fill;
+  int bits;
+  int hz;
+  double issued_ns;
+  mbed::event_callback_t callback;
+  int event;
+};
+
+// Stands in for the DMA engine and its completion interrupt
+class DmaThread {
+  public:
+    DmaThread() : _stop(false), _worker(&DmaThread::Run, this) {}
+
+    ~DmaThread() {
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+      }
+      _wake.notify_one();
+      _worker.join();
+    }
+
+    void Push(const DmaJob &job) {
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _jobs.push_back(job);
+      }
+      _wake.notify_one();
+    }
+
+  private:
+    void Run() {
+      for (;;) {
+        DmaJob job;
+        {
+          std::unique_lock<std::mutex> guard(_lock);
+          _wake.wait(guard, [this] { return _stop || !_jobs.empty(); });
+          if (_jobs.empty()) return;
+          job = _jobs.front();
+          _jobs.pop_front();
+        }
+        int total = job.tx_length > job.rx_length ? job.tx_length : job.rx_length;
+        for (int i = 0; i < total; i++) {
+          uint8_t in = host::Transfer(job.tx && i < job.tx_length ? job.tx[i] : (uint8_t)job.fill, 1);
+          if (job.rx && i < job.rx_length) job.rx[i] = in;
+        }
+        host::Stats().frames += total;
+        double done = host::ChargeDma(job.issued_ns, (double)total * job.bits * 1e9 / job.hz);
+        host::RaiseAt(done);
+        while (host::Now() < done) std::this_thread::yield();
+        host::ClearIrq();
+        if (job.callback && (job.event & SPI_EVENT_COMPLETE)) {
+          std::lock_guard<std::recursive_mutex> irq(irq_lock);
+          irq_time_ns = done;
+          job.callback(SPI_EVENT_COMPLETE);
+          irq_time_ns = -1;
+        }
+      }
+    }
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::deque<DmaJob> _jobs;
+    bool _stop;
+    std::thread _worker;
+};
+
+DmaThread &Dma() {
+  static DmaThread dma;
+  return dma;
+}
+
+}
+
+#undef fread
+#undef fwrite
+
+size_t HostFread(void *ptr, size_t size, size_t count, FILE *stream) {
+  size_t n = fread(ptr, size, count, stream);
+  host::ChargeSd(n * size);
+  return n;
+}
+
+size_t HostFwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
+  size_t n = fwrite(ptr, size, count, stream);
+  host::ChargeSd(n * size);
+  return n;
+}
+
+void core_util_critical_section_enter() {
+  irq_lock.lock();
+  critical_depth++;
+}
+
+void core_util_critical_section_exit() {
+  critical_depth--;
+  irq_lock.unlock();
+}
+
+namespace host {
+
+// Pins only change on a set or reset bit of their own mask
+PortRegister &PortRegister::operator=(uint32_t bits) {
+  if (bits & 0x10000u) GpioWrite(pin, 0, Cost().gpio_register_ns);
+  else if (bits & 1u) GpioWrite(pin, 1, Cost().gpio_register_ns);
+  return *this;
+}
+
+}
+
+namespace {
+
+const int kMaxPorts = 16;
+host::PortRegister ports[kMaxPorts];
+int port_count = 0;
+
+host::PortRegister *Port(PinName pin) {
+  for (int i = 0; i < port_count; i++) {
+    if (ports[i].pin == (uint32_t)pin) return &ports[i];
+  }
+  if (port_count == kMaxPorts) return NULL;
+  ports[port_count].pin = (uint32_t)pin;
+  return &ports[port_count++];
+}
+
+}
+
+void gpio_init_out_ex(gpio_t *obj, PinName pin, int value) {
+  obj->mask = 1;
+  obj->pin = pin;
+  obj->reg_set = Port(pin);
+  obj->reg_clr = obj->reg_set;
+  gpio_write(obj, value);
+}
+
+// The H7 has no BRR, so resets go through the high half of BSRR
+void gpio_write(gpio_t *obj, int value) {
+  if (value) *obj->reg_set = obj->mask;
+  else *obj->reg_clr = obj->mask << 16;
+}
+
+namespace mbed {
+
+DigitalOut::DigitalOut(PinName pin, int value) : _pin(pin), _value(value) {
+  write(value);
+}
+
+void DigitalOut::write(int value) {
+  _value = value;
+  host::GpioWrite((uint32_t)_pin, value, host::Cost().digital_out_ns);
+}
+
+int DigitalOut::read() {
+  return _value;
+}
+
+}
+
+namespace mbed {
+
+SPI::SPI(PinName mosi, PinName miso, PinName sclk, PinName ssel)
+  : _bits(8), _mode(0), _hz(1000000), _fill((char)0xFF), _ssel(ssel)
+{
+  (void)mosi; (void)miso; (void)sclk;
+}
+
+void SPI::format(int bits, int mode) {
+  _bits = bits;
+  _mode = mode;
+  host::Stats().spi_calls++;
+  host::ChargeOverhead(host::Cost().spi_call_ns);
+}
+
+void SPI::frequency(int hz) {
+  _hz = hz;
+}
+
+void SPI::set_default_write_value(char data) {
+  _fill = data;
+}
+
+int SPI::write(int value) {
+  uint32_t out = (uint32_t)value;
+  uint32_t in = 0;
+  if (_ssel != NC) host::HardwareSelect(_ssel, 0);
+  for (int shift = _bits - 8; shift >= 0; shift -= 8) {
+    in = (in << 8) | host::Transfer((uint8_t)(out >> shift), 1);
+  }
+  if (_ssel != NC) host::HardwareSelect(_ssel, 1);
+  host::BusStats &stats = host::Stats();
+  stats.spi_calls++;
+  if (critical_depth > 0) stats.critical_calls++;
+  stats.frames++;
+  host::ChargeOverhead(host::Cost().spi_call_ns);
+  host::ChargeWire(_bits * 1e9 / _hz);
+  return (int)in;
+}
+
+// Like the STM32 HAL, every buffer element is clocked as one frame of the
+// current width, so byte buffers only map 1:1 onto the wire in 8-bit format.
+int SPI::write(const char *tx_buffer, int tx_length, char *rx_buffer, int rx_length) {
+  int total = tx_length > rx_length ? tx_length : rx_length;
+  if (_ssel != NC) host::HardwareSelect(_ssel, 0);
+  for (int i = 0; i < total; i++) {
+    uint8_t out = (uint8_t)(i < tx_length ? tx_buffer[i] : _fill);
+    uint8_t in = 0;
+    for (int shift = _bits - 8; shift >= 0; shift -= 8) {
+      in = host::Transfer(shift ? 0 : out, 1);
+    }
+    if (i < rx_length) rx_buffer[i] = (char)in;
+  }
+  if (_ssel != NC) host::HardwareSelect(_ssel, 1);
+  host::BusStats &stats = host::Stats();
+  stats.spi_calls++;
+  if (critical_depth > 0) stats.critical_calls++;
+  stats.frames += total;
+  host::ChargeOverhead(host::Cost().spi_call_ns + total * host::Cost().spi_block_byte_ns);
+  host::ChargeWire((double)total * _bits * 1e9 / _hz);
+  return total;
+}
+
+}
+
+namespace mbed {
+
+// Only the driver call is charged to the CPU; the wire time is spent on the
+// DMA timeline while the caller keeps running
+int SPI::transfer_internal(const void *tx_buffer, int tx_length, void *rx_buffer, int rx_length,
+                           const event_callback_t &callback, int event) {
+  DmaJob job = { (const uint8_t *)tx_buffer, tx_length, (uint8_t *)rx_buffer, rx_length,
+                 _fill, _bits, _hz, irq_time_ns >= 0 ? irq_time_ns : host::Now(), callback, event };
+  host::Stats().spi_calls++;
+  host::ChargeOverhead(host::Cost().spi_call_ns);
+  Dma().Push(job);
+  return 0;
+}
+
+}
+
+namespace mbed {
+
+namespace {
+
+int Lanes(qspi_bus_width_t width) {
+  return width == QSPI_CFG_BUS_QUAD ? 4 : width == QSPI_CFG_BUS_DUAL ? 2 : 1;
+}
+
+}
+
+QSPI::QSPI(PinName io0, PinName io1, PinName io2, PinName io3, PinName sclk, PinName ssel, int mode)
+  : _ssel(ssel), _hz(1000000), _inst_lanes(1), _address_lanes(1), _address_bytes(3), _data_lanes(1), _dummy_cycles(0)
+{
+  (void)io0; (void)io1; (void)io2; (void)io3; (void)sclk; (void)mode;
+}
+
+// Only stores the format for the following commands, like the HAL
+qspi_status_t QSPI::configure_format(qspi_bus_width_t inst_width, qspi_bus_width_t address_width,
+                                     qspi_address_size_t address_size, qspi_bus_width_t alt_width,
+                                     qspi_alt_size_t alt_size, qspi_bus_width_t data_width, int dummy_cycles) {
+  (void)alt_width; (void)alt_size;
+  _inst_lanes = Lanes(inst_width);
+  _address_lanes = Lanes(address_width);
+  _address_bytes = (int)address_size + 1;
+  _data_lanes = Lanes(data_width);
+  _dummy_cycles = dummy_cycles;
+  return QSPI_STATUS_OK;
+}
+
+qspi_status_t QSPI::set_frequency(int hz) {
+  _hz = hz;
+  return QSPI_STATUS_OK;
+}
+
+qspi_status_t QSPI::read(qspi_inst_t instruction, int alt, int address, char *rx_buffer, size_t *rx_length) {
+  (void)alt;
+  return Command(instruction, address, NULL, 0, rx_buffer, *rx_length);
+}
+
+qspi_status_t QSPI::write(qspi_inst_t instruction, int alt, int address, const char *tx_buffer, size_t *tx_length) {
+  (void)alt;
+  return Command(instruction, address, tx_buffer, *tx_length, NULL, 0);
+}
+
+qspi_status_t QSPI::command_transfer(qspi_inst_t instruction, int address, const char *tx_buffer, size_t tx_length,
+                                     const char *rx_buffer, size_t rx_length) {
+  return Command(instruction, address, tx_buffer, tx_length, (char *)rx_buffer, rx_length);
+}
+
+// Each phase goes out on its own lane count: a byte on n lanes takes 8/n
+// clocks. Dummy cycles are fed to the device as filler bytes on the data lanes;
+// like mbed, command_transfer sends the configured count too.
+qspi_status_t QSPI::Command(qspi_inst_t instruction, int address, const char *tx_buffer, size_t tx_length,
+                            char *rx_buffer, size_t rx_length) {
+  double clocks = 0;
+  host::HardwareSelect(_ssel, 0);
+  host::Transfer((uint8_t)instruction, _inst_lanes);
+  clocks += 8.0 / _inst_lanes;
+  if (address != -1) {
+    for (int i = _address_bytes - 1; i >= 0; i--) host::Transfer((uint8_t)(address >> (8 * i)), _address_lanes);
+    clocks += _address_bytes * 8.0 / _address_lanes;
+  }
+  if (_dummy_cycles) {
+    for (int i = 0; i < _dummy_cycles * _data_lanes / 8; i++) host::Transfer(0xFF, _data_lanes);
+    clocks += _dummy_cycles;
+  }
+  for (size_t i = 0; i < tx_length; i++) host::Transfer((uint8_t)tx_buffer[i], _data_lanes);
+  for (size_t i = 0; i < rx_length; i++) rx_buffer[i] = (char)host::Transfer(0xFF, _data_lanes);
+  clocks += (tx_length + rx_length) * 8.0 / _data_lanes;
+  host::HardwareSelect(_ssel, 1);
+  host::BusStats &stats = host::Stats();
+  stats.spi_calls++;
+  stats.frames += tx_length + rx_length;
+  host::ChargeOverhead(host::Cost().spi_call_ns + (tx_length + rx_length) * host::Cost().spi_block_byte_ns);
+  host::ChargeWire(clocks * 1e9 / _hz);
+  return QSPI_STATUS_OK;
+}
+
+}
+
+namespace rtos {
+
+void Semaphore::acquire() {
+  std::unique_lock<std::mutex> guard(_lock);
+  _cv.wait(guard, [this] { return _count > 0; });
+  _count--;
+}
+
+bool Semaphore::try_acquire() {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (_count == 0) return false;
+  _count--;
+  return true;
+}
+
+osStatus Semaphore::release() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _count++;
+  }
+  _cv.notify_one();
+  return osOK;
+}
+
+Thread::Thread(osPriority_t priority, uint32_t stack_size, unsigned char *stack_mem, const char *name) {
+  (void)priority; (void)stack_size; (void)stack_mem; (void)name;
+}
+
+Thread::~Thread() {
+  if (_thread.joinable()) _thread.join();
+}
+
+osStatus Thread::start(mbed::Callback<void()> task) {
+  _thread = std::thread(task);
+  return osOK;
+}
+
+osStatus Thread::join() {
+  if (_thread.joinable()) _thread.join();
+  return osOK;
+}
+
+}
@@ -0,0 +1,109 @@
+/*  SRAM23AA04M.cpp - Behavioural model of the Microchip 23AA04M serial SRAM.
+ */
+
+#include "SRAM23AA04M.h"
+#include <string.h>
+
+SRAM23AA04M::SRAM23AA04M() {
+  Reset();
+}
+
+// Power-on state: sequential mode, array contents undefined (zeroed here)
+void SRAM23AA04M::Reset() {
+  memset(_mem, 0, sizeof(_mem));
+  _status = kSeqMode;
+  _quad = false;
+  _phase = kIgnore;
+  ClearCounters();
+}
+
+void SRAM23AA04M::ClearCounters() {
+  _errors = 0;
+  memset(_commands, 0, sizeof(_commands));
+}
+
+void SRAM23AA04M::Violation() {
+  _errors++;
+  _phase = kIgnore;
+}
+
+void SRAM23AA04M::Select() {
+  _phase = kOpcode;
+  _count = 0;
+}
+
+void SRAM23AA04M::Deselect() {
+  _phase = kIgnore;
+}
+
+// Address after a data byte: wraps within the page in page mode and around
+// the whole array in sequential mode
+uint32_t SRAM23AA04M::Next(uint32_t addr) const {
+  if ((_status & 0xC0) == kPageMode) return (addr & ~(kPageSize - 1)) | ((addr + 1) & (kPageSize - 1));
+  return (addr + 1) & (kSize - 1);
+}
+
+uint8_t SRAM23AA04M::Transfer(uint8_t mosi, int lanes) {
+  if (_phase == kOpcode && !_quad && lanes == 4 && mosi == kRstio) {
+    _phase = kIgnore;                               // RSTIO on 4 lanes while in SPI mode: a no-op
+    return 0;
+  }
+  if (lanes != (_quad ? 4 : 1) && _phase != kIgnore) {
+    Violation();
+    return 0;
+  }
+  switch (_phase) {
+    case kOpcode:
+      _opcode = mosi;
+      _commands[mosi]++;
+      _addr = 0;
+      _count = 3;
+      if (mosi == kRead || mosi == kHsRead || mosi == kWrite) _phase = kAddress;
+      else if (mosi == kRdsr) _phase = kStatusOut;
+      else if (mosi == kWrsr) _phase = kStatusIn;
+      else if (mosi == kEqio && !_quad) { _quad = true; _phase = kIgnore; }
+      else if (mosi == kRstio && _quad) { _quad = false; _phase = kIgnore; }
+      else Violation();
+      return 0;
+
+    case kAddress:
+      _addr = (_addr << 8) | mosi;
+      if (--_count == 0) {
+        _addr &= kSize - 1;
+        if (_quad) _count = _opcode == kHsRead ? kQuadHsReadDummy : _opcode == kRead ? kQuadReadDummy : 0;
+        else _count = _opcode == kHsRead ? 1 : 0; // HSREAD has 8 dummy clocks
+        _phase = _count ? kDummy : kData;
+      }
+      return 0;
+
+    case kDummy:
+      if (--_count == 0) _phase = kData;
+      return 0;
+
+    case kData: {
+      if ((_status & 0xC0) == kByteMode && _count > 0) {
+        Violation();                                // byte mode moves a single byte per command
+        return 0;
+      }
+      uint8_t miso = 0;
+      if (_opcode == kWrite) _mem[_addr] = mosi;
+      else miso = _mem[_addr];
+      _addr = Next(_addr);
+      _count++;
+      return miso;
+    }
+
+    case kStatusOut:
+      return _status;
+
+    case kStatusIn:
+      if ((mosi & 0xC0) == 0xC0) Violation();       // reserved mode
+      else _status = mosi;
+      _phase = kIgnore;
+      return 0;
+
+    case kIgnore:
+    default:
+      return 0;
+  }
+}
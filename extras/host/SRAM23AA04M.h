@@ -0,0 +1,69 @@
+/*  SRAM23AA04M.h - Behavioural model of the Microchip 23AA04M serial SRAM.
+ *  Models the 512 KB array, the status register with byte/page/sequential
+ *  modes, and the READ/HSREAD/WRITE/RDSR/WRSR commands, one byte per call
+ *  from the emulated bus. EQIO/RSTIO switch between the SPI and SQI
+ *  interfaces; in SQI mode every byte must arrive on 4 lanes and reads have
+ *  dummy cycles. Protocol violations are counted, not fatal, so a benchmark
+ *  can report them next to its timings.
+ */
+
+#ifndef SRAM23AA04M_h
+#define SRAM23AA04M_h
+
+#include "HostBus.h"
+
+class SRAM23AA04M : public host::BusDevice {
+  public:
+    static const uint32_t kSize = 0x80000;
+    static const uint32_t kPageSize = 32;
+
+    // Instruction set
+    static const uint8_t kRead   = 0x03;
+    static const uint8_t kHsRead = 0x0B;
+    static const uint8_t kWrite  = 0x02;
+    static const uint8_t kRdsr   = 0x05;
+    static const uint8_t kWrsr   = 0x01;
+    static const uint8_t kEqio   = 0x38;
+    static const uint8_t kRstio  = 0xFF;
+
+    // Dummy bytes between address and data in SQI mode (2 clocks each)
+    static const int kQuadReadDummy   = 1;
+    static const int kQuadHsReadDummy = 3;
+
+    // Operating modes, status register bits 7:6
+    static const uint8_t kByteMode = 0x00;
+    static const uint8_t kPageMode = 0x80;
+    static const uint8_t kSeqMode  = 0x40;
+
+    SRAM23AA04M();
+    void Reset();
+
+    void Select();
+    void Deselect();
+    uint8_t Transfer(uint8_t mosi, int lanes);
+
+    uint8_t *Memory() { return _mem; }
+    uint8_t Status() const { return _status; }
+    bool Quad() const { return _quad; }
+    uint32_t Errors() const { return _errors; }
+    uint64_t Commands(uint8_t opcode) const { return _commands[opcode]; }
+    void ClearCounters();
+
+  private:
+    enum Phase { kOpcode, kAddress, kDummy, kData, kStatusOut, kStatusIn, kIgnore };
+
+    void Violation();
+    uint32_t Next(uint32_t addr) const;
+
+    uint8_t _mem[kSize];
+    uint8_t _status;
+    bool _quad;                         // SQI interface active
+    Phase _phase;
+    uint8_t _opcode;
+    uint32_t _addr;
+    int _count;                         // address or dummy bytes still expected, data bytes moved
+    uint32_t _errors;
+    uint64_t _commands[256];
+};
+
+#endif
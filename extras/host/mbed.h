@@ -0,0 +1,230 @@
+/*  mbed.h - Host stand-in for the parts of mbed OS used by SRAMsimple.
+ *  SPI traffic goes to the emulated bus in HostBus.h instead of a peripheral.
+ *  Asynchronous transfers run on a worker thread that plays the part of the
+ *  DMA completion interrupt; critical sections exclude that thread.
+ *  rtos::Thread and rtos::Semaphore map onto std::thread.
+ *  GPIO follows the STM32 HAL of the Portenta H7: gpio_t points at the
+ *  port's BSRR, which here is a register whose stores move pins on the bus.
+ */
+
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef int PinName;
+
+#define DEVICE_SPI_ASYNCH 1
+#define DEVICE_QSPI 1
+#define TARGET_STM 1
+
+#define SPI_EVENT_ERROR       (1 << 1)
+#define SPI_EVENT_COMPLETE    (1 << 2)
+#define SPI_EVENT_RX_OVERFLOW (1 << 3)
+#define SPI_EVENT_ALL         (SPI_EVENT_ERROR | SPI_EVENT_COMPLETE | SPI_EVENT_RX_OVERFLOW)
+
+typedef enum {
+  QSPI_CFG_BUS_SINGLE,
+  QSPI_CFG_BUS_DUAL,
+  QSPI_CFG_BUS_QUAD,
+} qspi_bus_width_t;
+
+typedef enum {
+  QSPI_CFG_ADDR_SIZE_8,
+  QSPI_CFG_ADDR_SIZE_16,
+  QSPI_CFG_ADDR_SIZE_24,
+  QSPI_CFG_ADDR_SIZE_32,
+} qspi_address_size_t;
+
+typedef uint8_t qspi_alt_size_t;
+#define QSPI_CFG_ALT_SIZE_8 8u
+
+typedef enum {
+  QSPI_STATUS_ERROR = -1,
+  QSPI_STATUS_INVALID_PARAMETER = -2,
+  QSPI_STATUS_OK = 0,
+} qspi_status_t;
+
+typedef int qspi_inst_t;
+
+typedef int osStatus;
+#define osOK 0
+
+typedef enum {
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+  osPriorityRealtime = 48,
+} osPriority_t;
+#define OS_STACK_SIZE 4096
+
+// Files on the Portenta's SD card go through the stdio retarget, so route
+// fread and fwrite through the host bus to charge them at SD card speed
+size_t HostFread(void *ptr, size_t size, size_t count, FILE *stream);
+size_t HostFwrite(const void *ptr, size_t size, size_t count, FILE *stream);
+#define fread HostFread
+#define fwrite HostFwrite
+
+void core_util_critical_section_enter();
+void core_util_critical_section_exit();
+
+namespace host {
+
+// A GPIO port's BSRR: the low half sets pins, the high half resets them
+class PortRegister {
+  public:
+    PortRegister &operator=(uint32_t bits);
+    uint32_t pin;
+};
+
+}
+
+// As on STM32, reg_set is the BSRR of the pin's port. Every host pin gets a
+// port of its own, so mask is always bit 0.
+typedef struct {
+  uint32_t mask;
+  host::PortRegister *reg_set;
+  host::PortRegister *reg_clr;
+  PinName pin;
+} gpio_t;
+
+void gpio_init_out_ex(gpio_t *obj, PinName pin, int value);
+void gpio_write(gpio_t *obj, int value);
+
+// Portenta H7 pins used by the examples
+#define NC    (-1)
+#define PC_2  0x22
+#define PC_3  0x23
+#define PI_0  0x80
+#define PI_1  0x81
+#define PB_2  0x12                    // QSPI clock
+#define PD_11 0x3B                    // QSPI IO0-IO3
+#define PD_12 0x3C
+#define PE_2  0x42
+#define PD_13 0x3D
+
+namespace mbed {
+
+template <typename F> class Callback;
+
+template <typename R, typename... Args>
+class Callback<R(Args...)> : public std::function<R(Args...)> {
+  public:
+    using std::function<R(Args...)>::function;
+};
+
+template <typename T, typename R, typename... Args>
+Callback<R(Args...)> callback(T *obj, R (T::*method)(Args...)) {
+  return [obj, method](Args... args) { return (obj->*method)(args...); };
+}
+
+typedef Callback<void(int)> event_callback_t;
+
+class DigitalOut {
+  public:
+    DigitalOut(PinName pin, int value = 0);
+    void write(int value);
+    int read();
+
+  private:
+    PinName _pin;
+    int _value;
+};
+
+// With an ssel pin the peripheral drives it as hardware NSS: it goes low for
+// the duration of each blocking write() call.
+class SPI {
+  public:
+    SPI(PinName mosi, PinName miso, PinName sclk, PinName ssel = NC);
+    void format(int bits, int mode = 0);
+    void frequency(int hz = 1000000);
+    int write(int value);
+    int write(const char *tx_buffer, int tx_length, char *rx_buffer, int rx_length);
+    void set_default_write_value(char data);
+
+    template <typename Type>
+    int transfer(const Type *tx_buffer, int tx_length, Type *rx_buffer, int rx_length,
+                 const event_callback_t &callback, int event = SPI_EVENT_COMPLETE) {
+      return transfer_internal(tx_buffer, tx_length, rx_buffer, rx_length, callback, event);
+    }
+
+  private:
+    int transfer_internal(const void *tx_buffer, int tx_length, void *rx_buffer, int rx_length,
+                          const event_callback_t &callback, int event);
+
+    int _bits;
+    int _mode;
+    int _hz;
+    char _fill;
+    PinName _ssel;
+};
+
+// Quad-SPI peripheral in indirect mode. Every call is one complete command
+// (instruction, address, dummy cycles, data) and the peripheral drives ssel.
+// An address or alt of -1 skips that phase.
+class QSPI {
+  public:
+    QSPI(PinName io0, PinName io1, PinName io2, PinName io3, PinName sclk, PinName ssel = NC, int mode = 0);
+    qspi_status_t configure_format(qspi_bus_width_t inst_width, qspi_bus_width_t address_width,
+                                   qspi_address_size_t address_size, qspi_bus_width_t alt_width,
+                                   qspi_alt_size_t alt_size, qspi_bus_width_t data_width, int dummy_cycles);
+    qspi_status_t set_frequency(int hz = 1000000);
+    qspi_status_t read(qspi_inst_t instruction, int alt, int address, char *rx_buffer, size_t *rx_length);
+    qspi_status_t write(qspi_inst_t instruction, int alt, int address, const char *tx_buffer, size_t *tx_length);
+    qspi_status_t command_transfer(qspi_inst_t instruction, int address, const char *tx_buffer, size_t tx_length,
+                                   const char *rx_buffer, size_t rx_length);
+
+  private:
+    qspi_status_t Command(qspi_inst_t instruction, int address, const char *tx_buffer, size_t tx_length,
+                          char *rx_buffer, size_t rx_length);
+
+    PinName _ssel;
+    int _hz;
+    int _inst_lanes;
+    int _address_lanes;
+    int _address_bytes;
+    int _data_lanes;
+    int _dummy_cycles;
+};
+
+}
+
+namespace rtos {
+
+class Semaphore {
+  public:
+    Semaphore(int32_t count = 0) : _count(count) {}
+    void acquire();
+    bool try_acquire();
+    osStatus release();
+
+  private:
+    std::mutex _lock;
+    std::condition_variable _cv;
+    int32_t _count;
+};
+
+// Priorities and stack sizes are accepted and ignored; the host scheduler runs the threads
+class Thread {
+  public:
+    Thread(osPriority_t priority = osPriorityNormal, uint32_t stack_size = OS_STACK_SIZE,
+           unsigned char *stack_mem = nullptr, const char *name = nullptr);
+    ~Thread();
+    osStatus start(mbed::Callback<void()> task);
+    osStatus join();
+
+  private:
+    std::thread _thread;
+};
+
+}
+
+#endif